@@ -0,0 +1,142 @@
+/**
+ * @file idle_rom.c
+ * @brief Writes the small ROM `make check` runs with and without idle loop skipping
+ *
+ * Every loop the skipper knows is in the main loop: LY, STAT, DIV and a WRAM byte set by the
+ * VBlank interrupt. Each frame scrolls the background and writes VRAM, so the screenshot shows
+ * any frame that ran differently.
+ * */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+static uint8_t rom[0x8000];
+static uint16_t pc;
+
+static void emit(const uint8_t *bytes, size_t size) {
+    memcpy(&rom[pc], bytes, size);
+    pc += size;
+}
+
+#define EMIT(...) emit((const uint8_t[]){__VA_ARGS__}, sizeof((const uint8_t[]){__VA_ARGS__}))
+
+// JR cc back to target, the offset counts from the end of the jump
+static void jr_back(uint8_t op, uint16_t target) {
+    EMIT(op, (uint8_t)(target - (pc + 2)));
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s out.gb\n", argv[0]);
+        return 1;
+    }
+
+    // VBlank: count frames in WRAM
+    pc = 0x40;
+    EMIT(0xF5,                      // push af
+         0xFA, 0x00, 0xC0,          // ld a,(C000)
+         0x3C,                      // inc a
+         0xEA, 0x00, 0xC0,          // ld (C000),a
+         0xF1,                      // pop af
+         0xD9);                     // reti
+
+    pc = 0x100;
+    EMIT(0x00, 0xC3, 0x50, 0x01);   // nop; jp 0150
+
+    memcpy(&rom[0x134], "IDLECHECK", 9);
+
+    pc = 0x150;
+    EMIT(0xF3,                      // di
+         0x31, 0xFE, 0xDF);         // ld sp,DFFE
+
+    // the LCD only goes off in VBlank
+    uint16_t wait_vblank = pc;
+    EMIT(0xF0, 0x44,                // ldh a,(LY)
+         0xFE, 0x90);               // cp 144
+    jr_back(0x38, wait_vblank);     // jr c
+    EMIT(0xAF,                      // xor a
+         0xE0, 0x40,                // ldh (LCDC),a
+         0x21, 0x00, 0x80);         // ld hl,8000
+
+    // tiles 0-255, every byte l ^ h
+    uint16_t fill_tiles = pc;
+    EMIT(0x7D,                      // ld a,l
+         0xAC,                      // xor h
+         0x22,                      // ld (hl+),a
+         0x7C,                      // ld a,h
+         0xFE, 0x90);               // cp 90
+    jr_back(0x20, fill_tiles);      // jr nz
+
+    // map 9800-9BFF, tile number l
+    EMIT(0x21, 0x00, 0x98);         // ld hl,9800
+    uint16_t fill_map = pc;
+    EMIT(0x7D,                      // ld a,l
+         0x22,                      // ld (hl+),a
+         0x7C,                      // ld a,h
+         0xFE, 0x9C);               // cp 9C
+    jr_back(0x20, fill_map);        // jr nz
+
+    EMIT(0x3E, 0xE4, 0xE0, 0x47,    // BGP = E4
+         0xAF, 0xEA, 0x00, 0xC0,    // frame counter = 0
+         0xE0, 0x0F,                // IF = 0
+         0x3E, 0x01, 0xE0, 0xFF,    // IE = VBlank
+         0x3E, 0x91, 0xE0, 0x40,    // LCD on, tiles at 8000, BG on
+         0x0E, 0x00,                // ld c,0
+         0xFB);                     // ei
+
+    uint16_t main_loop = pc;
+    uint16_t wait_ly = pc;
+    EMIT(0xF0, 0x44,                // ldh a,(LY)
+         0xFE, 0x40);               // cp 64
+    jr_back(0x20, wait_ly);         // jr nz
+    uint16_t wait_hblank = pc;
+    EMIT(0xF0, 0x41,                // ldh a,(STAT)
+         0xE6, 0x03);               // and 3
+    jr_back(0x20, wait_hblank);     // jr nz
+    EMIT(0xF0, 0x04,                // ldh a,(DIV)
+         0x47);                     // ld b,a
+    uint16_t wait_div = pc;
+    EMIT(0xF0, 0x04,                // ldh a,(DIV)
+         0xB8);                     // cp b
+    jr_back(0x28, wait_div);        // jr z
+    EMIT(0x81,                      // add c, DIV lands in the registers
+         0x4F,                      // ld c,a
+         0xFA, 0x00, 0xC0,          // ld a,(C000)
+         0x47);                     // ld b,a
+    uint16_t wait_frame = pc;
+    EMIT(0xFA, 0x00, 0xC0,          // ld a,(C000)
+         0xB8);                     // cp b
+    jr_back(0x28, wait_frame);      // jr z
+
+    // VBlank just started: scroll and change a map entry
+    EMIT(0xE0, 0x43,                // ldh (SCX),a
+         0xCB, 0x3F,                // srl a
+         0xE0, 0x42,                // ldh (SCY),a
+         0x26, 0x98,                // ld h,98
+         0x6F,                      // ld l,a
+         0x71);                     // ld (hl),c
+    EMIT(0xC3, main_loop & 0xFF, main_loop >> 8); // jp main
+
+    // ROM only, 32 KiB, no RAM
+    uint8_t checksum = 0;
+    for (int i = 0x134; i < 0x14D; i++) {
+        checksum = checksum - rom[i] - 1;
+    }
+    rom[0x14D] = checksum;
+
+    uint16_t global = 0;
+    for (size_t i = 0; i < sizeof(rom); i++) {
+        global += (i == 0x14E || i == 0x14F) ? 0 : rom[i];
+    }
+    rom[0x14E] = global >> 8;
+    rom[0x14F] = global & 0xFF;
+
+    FILE *fpointer = fopen(argv[1], "wb");
+    if (!fpointer) {
+        fprintf(stderr, "Failed to open %s\n", argv[1]);
+        return 1;
+    }
+    fwrite(rom, 1, sizeof(rom), fpointer);
+    fclose(fpointer);
+    return 0;
+}
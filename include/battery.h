@@ -0,0 +1,59 @@
+/**
+ * @file battery.h
+ * @brief Battery backed cart RAM kept in a .sav file, written back on a background thread
+ * */
+#pragma once
+
+#include <setup.h>
+#include <pthread.h>
+#include <mbc.h>
+
+/**
+ * @brief Host frames between two hand overs of the dirty pages to the writer
+ * */
+#define BATTERY_FLUSH_FRAMES 60
+
+/**
+ * @brief Save file of the loaded cartridge, the emulation thread only ever try locks it
+ * */
+typedef struct {
+    char path[1040];
+    FILE *file;
+    uint32_t ram_size;
+    bool has_rtc;
+    uint32_t frames; // since the last hand over
+
+    // shared with the writer thread under lock
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    uint8_t *shadow; // pages handed over, a full copy of the cart RAM
+    uint64_t pending[MBC_DIRTY_WORDS];
+    uint8_t rtc[RTC_SAVE_SIZE];
+    bool rtc_pending;
+    bool quit;
+
+    uint8_t *out; // writer side copy, written without holding the lock
+} battery_context;
+
+/**
+ * @brief Loads the save file if the cartridge has a battery and starts tracking its RAM
+ * @param path save file, created on the first write back if it doesn't exist
+ * @return false if the cartridge has no battery backed RAM or clock
+ * */
+bool battery_open(Gameboy *gb, const char *path);
+
+/**
+ * @brief Call once per host frame, hands the dirty pages to the writer every BATTERY_FLUSH_FRAMES
+ * */
+void battery_update(Gameboy *gb);
+
+/**
+ * @brief Writes back everything left, waits for the writer and stops tracking
+ * */
+void battery_close(Gameboy *gb);
+
+/**
+ * @brief Save file name next to the ROM, the extension replaced with .sav
+ * */
+void battery_path(char *path, size_t size, const char *rom_path);
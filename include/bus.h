@@ -6,25 +6,83 @@
 
 #include <setup.h>
 #include <iogm.h>
+#include <mbc.h>
 /**
- * @brief Represents the memory bus, with ROM banks and I/O registers
+ * @brief Represents the memory bus, with the work RAM and I/O registers, ROM and cart RAM belong to the mapper
 */
 typedef struct{
-    uint8_t memory[0x200000];
+    uint8_t wram[0x2000]; // 0xC000-0xDFFF, echoed at 0xE000-0xFDFF
+    uint8_t hram[0x7F]; // 0xFF80-0xFFFE
     IORegisters io;
     uint16_t internal_divider;
-    uint8_t current_bank;
-    uint8_t bank_upper;
-    uint8_t banking_mode;
-    uint8_t ram_enabled;
+    mbc_context mbc;
+
+    // host pointers for every 256 byte page, NULL pages go through the handlers
+    const uint8_t *read_page[0x100];
+    uint8_t *write_page[0x100];
 } Bus;
 
-uint8_t BusRead(Bus *bus, uint16_t address);
-uint16_t BusRead16(Bus *bus, uint16_t address);
-void BusWrite(Bus *bus, uint16_t address, uint8_t value);
+/**
+ * @brief Rebuilds the page tables, needed after a ROM is loaded or a state restored
+ * */
+void BusUpdateMap(Bus *bus);
+
+/**
+ * @brief Repoints only the ROM and cart RAM pages at the current banks
+ * */
+void BusMapCart(Bus *bus);
+
+/**
+ * @brief Reads from memory without a mapped page: OAM, IO and cart RAM the mapper handles itself
+ * */
+uint8_t BusReadHandler(Bus *bus, uint16_t address);
+/**
+ * @brief Writes to memory without a mapped page, including the MBC registers
+ * */
+void BusWriteHandler(Bus *bus, uint16_t address, uint8_t value);
+
+static inline uint8_t BusRead(Bus *bus, uint16_t address) {
+    const uint8_t *page = bus->read_page[address >> 8];
+    if (page) {
+        return page[address & 0xFF];
+    }
+    return BusReadHandler(bus, address);
+}
+
+static inline uint16_t BusRead16(Bus *bus, uint16_t address) {
+    uint16_t low = BusRead(bus, address);
+    uint16_t high = BusRead(bus, address + 1);
+    return (high << 8) | low;
+}
+
+static inline void BusWrite(Bus *bus, uint16_t address, uint8_t value) {
+    uint8_t *page = bus->write_page[address >> 8];
+    if (page) {
+        page[address & 0xFF] = value;
+        return;
+    }
+    BusWriteHandler(bus, address, value);
+}
 
 /**
  *	@brief Steps the system timer by number of CPU cycles
  * */
 void TimerStep(Bus *bus, int cycles);
 
+/**
+ * @brief Resets the divider on a DIV write, a falling edge on the selected bit still clocks TIMA
+ * */
+void TimerResetDivider(Bus *bus);
+
+/**
+ * @brief DIV handlers for the IO register table
+ * */
+uint8_t TimerReadDivider(Gameboy *gb, uint16_t address);
+void TimerWriteDivider(Gameboy *gb, uint16_t address, uint8_t value);
+
+/**
+ * @brief Number of 4 cycle steps until TIMA overflows and requests its interrupt
+ * @return 0 if the timer is stopped
+ * */
+uint32_t TimerTicksToOverflow(Bus *bus);
+
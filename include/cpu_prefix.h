@@ -6,20 +6,42 @@
 
 #include <setup.h>
 #include <cpu.h>
-/**
- * @brief Helper function to fetch values for prefix instructions
- * @param cpu Pointer to the cpu
- * @param bus Pointer to the bus
- * @param reg code index representing the target register
- * @return uint8_t byte value of the target
- * */
-uint8_t get_cb_value(CPU *cpu, Bus *bus, uint8_t reg);
-/***
- * @brief Function for setting values to the target register
- * @param cpu Pointer to the cpu
- * @param bus Pointer to the bus
- * @param reg target register
- * @param value the new value to be set in the target
- */
-void set_cb_value(CPU *cpu, Bus *bus, uint8_t reg, uint8_t value);
 
+/**
+ * @brief Rotates left, bit 7 goes to carry and bit 0
+ * @return uint8_t the rotated value
+ * */
+uint8_t cb_rlc(CPU *cpu, uint8_t value);
+/**
+ * @brief Rotates right, bit 0 goes to carry and bit 7
+ * */
+uint8_t cb_rrc(CPU *cpu, uint8_t value);
+/**
+ * @brief Rotates left through the carry flag
+ * */
+uint8_t cb_rl(CPU *cpu, uint8_t value);
+/**
+ * @brief Rotates right through the carry flag
+ * */
+uint8_t cb_rr(CPU *cpu, uint8_t value);
+/**
+ * @brief Arithmetic shift left
+ * */
+uint8_t cb_sla(CPU *cpu, uint8_t value);
+/**
+ * @brief Arithmetic shift right, bit 7 is kept
+ * */
+uint8_t cb_sra(CPU *cpu, uint8_t value);
+/**
+ * @brief Swaps the upper and lower nibble
+ * */
+uint8_t cb_swap(CPU *cpu, uint8_t value);
+/**
+ * @brief Logical shift right
+ * */
+uint8_t cb_srl(CPU *cpu, uint8_t value);
+/**
+ * @brief Tests a single bit and sets the Z flag if it is clear
+ * @param bit index of the tested bit
+ * */
+void cb_bit(CPU *cpu, uint8_t value, uint8_t bit);
@@ -5,15 +5,40 @@
 #pragma once
 #include <setup.h>
 #include <bus.h>
-void dma_start(uint8_t start);
+
+/**
+ * @brief State of the OAM DMA transfer
+ * */
+typedef struct {
+    bool active;
+    uint8_t byte;
+    uint8_t value;
+    uint8_t start_delay;
+
+    bool bulk_enabled; // copies transfers from mapped pages in one go, a host setting
+    bool bulk; // the running transfer is copied at once when it ends
+    uint64_t bulk_end; // scheduler tick that writes the last byte
+} dma_context;
+
+void dma_start(Gameboy *gb, uint8_t start);
+
+/**
+ * @brief Bulk transfers: copies all 160 bytes at the tick the last one would have been written
+ * */
+void dma_finish_bulk(Gameboy *gb);
 
 /**
  * @brief Steps the DMA pipeline, transfers data in cycles
  * */
-void dma_tick(Bus *bus);
+void dma_tick(Gameboy *gb);
 /**
  * @brief Checker if the dma is currently dma_transfering
  * @return false if DMA is idle
  * */
-bool dma_transfering();
+bool dma_transfering(Gameboy *gb);
+/**
+ * @brief Number of ticks until the DMA needs to be stepped again
+ * @return 0 if the DMA is idle
+ * */
+uint32_t dma_ticks_to_event(Gameboy *gb);
 
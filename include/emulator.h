@@ -5,13 +5,82 @@
 #pragma once
 
 #include <setup.h>
+#include <stddef.h>
 #include <cpu.h>
 #include <bus.h>
+#include <ppu.h>
+#include <lcd.h>
+#include <dma.h>
+#include <gamepad.h>
+#include <sched.h>
+#include <tile_cache.h>
+#include <ppu_kernels.h>
+#include <battery.h>
+#include <idle.h>
 /**
- * @brief the main Gameboy struct
+ * @brief the main Gameboy struct, holds the whole state of one emulated system
  * */
-typedef struct{
+struct gameboy {
     CPU cpu;
     Bus bus;
-} Gameboy;
+    ppu_context ppu;
+    lcd_context lcd;
+    dma_context dma;
+    gamepad_context gamepad;
+    sched_context sched;
+    tile_cache tile_cache;
+    const ppu_kernels *kernels;
+    battery_context *battery; // NULL unless a save file is open
+    idle_context idle;
+};
 
+/**
+ * @brief Gets the Gameboy that owns a bus
+ * */
+static inline Gameboy *gb_from_bus(Bus *bus) {
+    return (Gameboy *)((char *)bus - offsetof(Gameboy, bus));
+}
+
+/**
+ * @brief Resets every component, a ROM can be loaded afterwards
+ * */
+void gb_init(Gameboy *gb);
+
+/**
+ * @brief Executes one instruction and catches the peripherals up when needed
+ * @return int T-cycles the instruction took
+ * */
+int gb_step(Gameboy *gb);
+
+/**
+ * @brief Runs the emulation until the PPU finished a frame
+ * */
+void gb_run_frame(Gameboy *gb);
+
+/**
+ * @brief Switches between the fifo and the scanline renderer, safe at any point
+ * */
+void gb_set_render_mode(Gameboy *gb, ppu_render_mode mode);
+
+/**
+ * @brief Draws only 1 of every n frames, the others keep the exact PPU timing without writing pixels
+ * @param n 0 or 1 draws every frame, takes effect from the next frame
+ * */
+void gb_set_frame_skip(Gameboy *gb, uint32_t n);
+
+/**
+ * @brief Lets OAM DMA copy all 160 bytes at once when it ends instead of one per M-cycle
+ * @details OAM is locked for the same time, only a source changed during the transfer shows the difference
+ * */
+void gb_set_dma_bulk(Gameboy *gb, bool enabled);
+
+/**
+ * @brief Lets polling loops that repeat unchanged jump ahead to the next event, on by default
+ * @details the emulated state stays the same as when every iteration runs, only faster
+ * */
+void gb_set_idle_skip(Gameboy *gb, bool enabled);
+
+/**
+ * @brief Releases the memory allocated by gb_init
+ * */
+void gb_free(Gameboy *gb);
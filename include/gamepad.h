@@ -19,15 +19,29 @@ typedef struct {
     bool right;
 } gamepad_state;
 
-void gamepad_init();
-bool gamepad_button_sel();
-bool gamepad_dir_sel();
+/**
+ * @brief Gamepad selection lines and button states
+ * */
+typedef struct {
+    bool button_sel;
+    bool dir_sel;
+    gamepad_state controller;
+} gamepad_context;
+
+bool gamepad_button_sel(Gameboy *gb);
+bool gamepad_dir_sel(Gameboy *gb);
 
 /**
  * @brief Specifies input type
  * @param value the byte written to the gamepad register
  * */
-void gamepad_set_sel(uint8_t value);
+void gamepad_set_sel(Gameboy *gb, uint8_t value);
 
-gamepad_state *gamepad_get_state();
-uint8_t gamepad_get_output();
+gamepad_state *gamepad_get_state(Gameboy *gb);
+uint8_t gamepad_get_output(Gameboy *gb);
+
+/**
+ * @brief JOYP handlers for the IO register table
+ * */
+uint8_t gamepad_read(Gameboy *gb, uint16_t address);
+void gamepad_write(Gameboy *gb, uint16_t address, uint8_t value);
@@ -0,0 +1,75 @@
+/**
+ * @file idle.h
+ * @brief Detects loops that only poll LY, STAT, IF, DIV or RAM and skips them up to the next event
+ * */
+#pragma once
+
+#include <setup.h>
+#include <cpu.h>
+
+/**
+ * @brief Loops with their own skip counters, later ones only count in the totals
+ * */
+#define IDLE_LOOP_SLOTS 16
+
+/**
+ * @brief Longest loop body looked at, from the branch target to the branch
+ * */
+#define IDLE_LOOP_BYTES 16
+
+/**
+ * @brief Skip counters of one loop
+ * */
+typedef struct {
+    uint16_t head; // branch target, the first instruction of the loop
+    uint16_t polled; // address of the register or RAM byte it reads
+    uint32_t skips;
+    uint64_t cycles;
+} idle_loop_stats;
+
+/**
+ * @brief Loop tracking of one instance, a loop is skipped after one iteration left the CPU unchanged
+ * */
+typedef struct {
+    bool enabled;
+
+    // last backward jump, the next one to the same head is compared against it
+    uint16_t head;
+    uint16_t tail; // address of the jump
+    CPU cpu;
+    uint64_t cycles; // scheduler cycles when it was taken
+    uint64_t next; // scheduler deadline at that point
+    uint8_t div; // DIV at that point, it changes without an event
+
+    // set by a verified iteration, the next instruction at the head skips ahead
+    bool armed;
+    uint32_t length; // cycles per iteration
+    uint32_t instructions; // per iteration, the jump back included
+    uint16_t polled;
+    bool polls_div;
+
+    uint64_t skips;
+    uint64_t skipped_cycles;
+    uint64_t skipped_instructions; // the skipped iterations would have executed these
+
+    idle_loop_stats loops[IDLE_LOOP_SLOTS];
+    uint32_t loop_count;
+} idle_context;
+
+/**
+ * @brief Called by a taken backward JR, arms the skip once an iteration repeated exactly
+ * @param from address of the JR instruction
+ * */
+void idle_branch(Gameboy *gb, uint16_t from);
+
+/**
+ * @brief Cycles the CPU can spend in an armed loop without anything it reads changing
+ * @details the step that skips executes no instruction, counters add skipped_instructions instead
+ * @return 0 to execute normally, otherwise a whole number of iterations
+ * */
+uint32_t idle_skip(Gameboy *gb);
+
+/**
+ * @brief Forgets the loop being tracked, the counters stay
+ * */
+void idle_reset(Gameboy *gb);
@@ -12,22 +12,38 @@ typedef struct {
     uint8_t registers[256];
 } IORegisters;
 
+/**
+ * @brief Register handler, gets the full address so subsystems can share one for a range
+ * */
+typedef uint8_t (*IOReadHandler)(Gameboy *gb, uint16_t address);
+typedef void (*IOWriteHandler)(Gameboy *gb, uint16_t address, uint8_t value);
+
+/**
+ * @brief Behavior of one register in 0xFF00-0xFF7F
+ * */
+typedef struct {
+    IOReadHandler read; // NULL reads the stored byte
+    IOWriteHandler write; // NULL stores the byte
+    uint8_t read_mask; // bits that read as 1 whatever is stored
+    uint8_t write_mask; // bits a write without handler changes
+    bool sync; // the peripherals change it or time from it, caught up before and rescheduled after a write
+} IORegister;
 
 void IOInit(IORegisters *io);
 
 /**
  * @brief Reads a byte value from IO register at an offset
- * @param io Pointer to the IO register context
- * @param offset The 8bit ofset
+ * @param gb Pointer to the Gameboy owning the registers
+ * @param offset The 8bit ofset, below 0x80
  * @return uint8_t The byte value fetched
  * */
-uint8_t IORead(IORegisters *io, uint8_t offset);
+uint8_t IORead(Gameboy *gb, uint8_t offset);
 
 
 /**
  * @brief Writes a byte value into an IO register at an offset
- * @param io Pointer to the IO register context
- * @param offset The 8bit ofset
+ * @param gb Pointer to the Gameboy owning the registers
+ * @param offset The 8bit ofset, below 0x80
  * @param value Byte to be written
  * */
-void IOWrite(IORegisters *io, uint8_t offset, uint8_t value);
+void IOWrite(Gameboy *gb, uint8_t offset, uint8_t value);
@@ -5,6 +5,20 @@
 
 #pragma once
 #include <setup.h>
+/**
+ * @brief LCDC split into its fields, updated on every write so the renderer doesn't extract bits per dot
+ * */
+typedef struct {
+    bool bgw_enable;
+    bool obj_enable;
+    uint8_t obj_height;
+    uint16_t bg_map_area;
+    uint16_t bgw_data_area; // 0x8000 unsigned tile indices, 0x8800 signed around 0x9000
+    bool win_enable;
+    uint16_t win_map_area;
+    bool lcd_enable;
+} lcdc_state;
+
 /**
  * @brief Struct holding the state of LCD registers
  * */
@@ -23,6 +37,7 @@ typedef struct {
     uint8_t win_x;
 
     //other 
+    lcdc_state lcdc_dec;
     uint32_t bg_colors[4];
     uint32_t sp1_colors[4];
     uint32_t sp2_colors[4];
@@ -38,22 +53,20 @@ typedef enum {
     MODE_XFER
 } lcd_mode;
 
-lcd_context *lcd_get_context();
-
-#define LCDC_BGW_ENABLE (BIT(lcd_get_context()->lcdc, 0))
-#define LCDC_OBJ_ENABLE (BIT(lcd_get_context()->lcdc, 1))
-#define LCDC_OBJ_HEIGHT (BIT(lcd_get_context()->lcdc, 2) ? 16 : 8)
-#define LCDC_BG_MAP_AREA (BIT(lcd_get_context()->lcdc, 3) ? 0x9C00 : 0x9800)
-#define LCDC_BGW_DATA_AREA (BIT(lcd_get_context()->lcdc, 4) ? 0x8000 : 0x8800)
-#define LCDC_WIN_ENABLE (BIT(lcd_get_context()->lcdc, 5))
-#define LCDC_WIN_MAP_AREA (BIT(lcd_get_context()->lcdc, 6) ? 0x9C00 : 0x9800)
-#define LCDC_LCD_ENABLE (BIT(lcd_get_context()->lcdc, 7))
+#define LCDC_BGW_ENABLE(gb) ((gb)->lcd.lcdc_dec.bgw_enable)
+#define LCDC_OBJ_ENABLE(gb) ((gb)->lcd.lcdc_dec.obj_enable)
+#define LCDC_OBJ_HEIGHT(gb) ((gb)->lcd.lcdc_dec.obj_height)
+#define LCDC_BG_MAP_AREA(gb) ((gb)->lcd.lcdc_dec.bg_map_area)
+#define LCDC_BGW_DATA_AREA(gb) ((gb)->lcd.lcdc_dec.bgw_data_area)
+#define LCDC_WIN_ENABLE(gb) ((gb)->lcd.lcdc_dec.win_enable)
+#define LCDC_WIN_MAP_AREA(gb) ((gb)->lcd.lcdc_dec.win_map_area)
+#define LCDC_LCD_ENABLE(gb) ((gb)->lcd.lcdc_dec.lcd_enable)
 
-#define LCDS_MODE ((lcd_mode)(lcd_get_context()->lcds & 0b11))
-#define LCDS_MODE_SET(mode) {lcd_get_context()->lcds &= ~0b11; lcd_get_context()->lcds |= mode;}
+#define LCDS_MODE(gb) ((lcd_mode)((gb)->lcd.lcds & 0b11))
+#define LCDS_MODE_SET(gb, mode) {(gb)->lcd.lcds &= ~0b11; (gb)->lcd.lcds |= mode;}
 
-#define LCDS_LYC (BIT(lcd_get_context()->lcds, 2))
-#define LCDS_LYC_SET(b) (BIT_SET(lcd_get_context()->lcds, 2, b))
+#define LCDS_LYC(gb) (BIT((gb)->lcd.lcds, 2))
+#define LCDS_LYC_SET(gb, b) (BIT_SET((gb)->lcd.lcds, 2, b))
 
 typedef enum {
     SS_HBLANK = (1 << 3),
@@ -62,18 +75,18 @@ typedef enum {
     SS_LYC = (1 << 6)
 } stat_src;
 
-#define LCDS_STAT_INT(src) (lcd_get_context()->lcds & src)
+#define LCDS_STAT_INT(gb, src) ((gb)->lcd.lcds & src)
 
-void lcd_init();
+void lcd_init(Gameboy *gb);
 
 /**
  * @brief Fetching register values in the lcd space
  * */
-uint8_t lcd_read(uint16_t address);
+uint8_t lcd_read(Gameboy *gb, uint16_t address);
 
 /**
  * @brief Writing new values to the lcd space
  * */
-void lcd_write(uint16_t address, uint8_t value);
+void lcd_write(Gameboy *gb, uint16_t address, uint8_t value);
 
 
@@ -0,0 +1,158 @@
+/**
+ * @file mbc.h
+ * @brief Cartridge memory bank controllers, picked from the cartridge type in the ROM header
+ * */
+#pragma once
+
+#include <setup.h>
+
+/**
+ * @brief Size of a switchable ROM bank
+ * */
+#define ROM_BANK_SIZE 0x4000
+/**
+ * @brief Size of a switchable cart RAM bank
+ * */
+#define RAM_BANK_SIZE 0x2000
+
+/**
+ * @brief Mapped ROM file, defined in rom.h
+ * */
+typedef struct rom_image rom_image;
+
+/**
+ * @brief Granularity of the cart RAM dirty tracking, one bus page
+ * */
+#define MBC_DIRTY_PAGE 0x100
+/**
+ * @brief Words in the dirty bitmap, enough for the largest 128 KB cart RAM
+ * */
+#define MBC_DIRTY_WORDS (0x20000 / MBC_DIRTY_PAGE / 64)
+
+/**
+ * @brief Emulated T-cycles per second of the MBC3 clock
+ * */
+#define RTC_CYCLES_PER_SECOND 4194304
+/**
+ * @brief Bytes of clock state appended to a battery file, the layout other emulators use
+ * */
+#define RTC_SAVE_SIZE 48
+
+/**
+ * @brief Supported mappers
+ * */
+typedef enum {
+    MBC_NONE,
+    MBC_1,
+    MBC_2,
+    MBC_3,
+    MBC_5
+} mbc_type;
+
+/**
+ * @brief Bank registers as the game wrote them, the rest of the mapper state follows from the header
+ * */
+typedef struct {
+    bool ram_enabled;
+    uint16_t rom_bank; // MBC1 5 bits, MBC2 4 bits, MBC3 7 bits, MBC5 9 bits
+    uint8_t ram_bank; // MBC1 the 2 bit upper register, MBC3 also selects the RTC registers
+    uint8_t mode; // MBC1 banking mode
+} mbc_registers;
+
+/**
+ * @brief MBC3 clock, only brought up to date when the game latches or writes it
+ * */
+typedef struct {
+    uint64_t counter; // T-cycles counted since day 0 00:00:00
+    uint64_t stamp; // CPU cycle the counter was last brought up to
+    bool halted;
+    bool carry; // day counter overflowed, sticky until the game clears it
+    uint8_t latched[5]; // seconds, minutes, hours, day low, day high as the game reads them
+    uint8_t latch_write; // last value written to 0x6000-0x7FFF, 0 then 1 latches
+} mbc_rtc;
+
+/**
+ * @brief Cartridge with its mapper, the bus reads the current banks through rom0, romx and ram_window
+ * */
+typedef struct {
+    mbc_type type;
+    bool multicart; // MBC1M, the upper bank bits start at bit 4
+    bool has_battery;
+    bool has_rtc;
+    bool has_rumble;
+
+    rom_image *image;
+    const uint8_t *rom; // the image data, read only and possibly shared with other instances
+    uint32_t rom_size; // power of two, at least two banks
+    uint8_t *ram;
+    uint32_t ram_size;
+    bool track_dirty; // set while a battery file is open
+    uint64_t dirty[MBC_DIRTY_WORDS]; // cart RAM pages written since the battery file last took them
+
+    mbc_registers regs;
+    mbc_rtc rtc;
+
+    const uint8_t *rom0; // 0x0000-0x3FFF
+    const uint8_t *romx; // 0x4000-0x7FFF
+    uint8_t *ram_window; // 0xA000-0xBFFF, NULL goes through mbc_ram_read and mbc_ram_write
+} mbc_context;
+
+/**
+ * @brief Sets up the mapper named in the header and allocates the cart RAM
+ * @param image ROM image, the mapper keeps the reference it is passed
+ * */
+void mbc_load(mbc_context *mbc, rom_image *image);
+
+/**
+ * @brief Releases the cart RAM and the reference on the ROM image
+ * */
+void mbc_free(mbc_context *mbc);
+
+/**
+ * @brief Points the windows at the banks selected by the registers, needed after the registers are restored
+ * */
+void mbc_update(mbc_context *mbc);
+
+/**
+ * @brief Handles a write to the mapper registers at 0x0000-0x7FFF
+ * @param now CPU cycle count, the clock is only advanced on a latch
+ * @return true if a window moved and the bus has to remap the cartridge pages
+ * */
+bool mbc_write(mbc_context *mbc, uint16_t address, uint8_t value, uint64_t now);
+
+/**
+ * @brief Cart RAM access that can't be mapped directly: disabled RAM, MBC2 nibbles and MBC3 RTC registers
+ * */
+uint8_t mbc_ram_read(mbc_context *mbc, uint16_t address);
+/**
+ * @brief Also takes the first write to a cart RAM page that is tracked and still clean
+ * @return true if the write marked a page dirty and the bus can map it for writing
+ * */
+bool mbc_ram_write(mbc_context *mbc, uint16_t address, uint8_t value, uint64_t now);
+
+/**
+ * @brief Whether writes to a mapped cart RAM page can bypass the mapper, tracked pages only once they are dirty
+ * @param page host pointer into the cart RAM
+ * */
+bool mbc_ram_writable(mbc_context *mbc, const uint8_t *page);
+
+/**
+ * @brief Marks all of the cart RAM dirty, needed when it is replaced as a whole
+ * */
+void mbc_dirty_all(mbc_context *mbc);
+
+/**
+ * @brief Writes the clock and the host time for a battery file
+ * @param host_time seconds since the unix epoch
+ * */
+void mbc_rtc_save(mbc_context *mbc, uint64_t now, uint8_t *data, int64_t host_time);
+
+/**
+ * @brief Restores a clock written by mbc_rtc_save and runs it for the host time passed since
+ * */
+void mbc_rtc_load(mbc_context *mbc, uint64_t now, const uint8_t *data, int64_t host_time);
+
+/**
+ * @brief Name of the mapper for log output
+ * */
+const char *mbc_name(mbc_context *mbc);
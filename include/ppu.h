@@ -25,19 +25,18 @@ typedef enum {
 } fetch_state;
 
 /**
- * @brief Pixel node in the fifo queue
+ * @brief Capacity of the pixel fifo, a tile is only added while 8 or less pixels are queued
  * */
-typedef struct fifo_entry{
-    struct fifo_entry *next;
-    uint32_t value;
-} fifo_entry;
+#define PIXEL_FIFO_SIZE 16
+
 /**
- * @brief Queue struct managing pixels waiting to be pushed
+ * @brief Ring buffer managing pixels waiting to be pushed
  * */
 typedef struct {
-    fifo_entry *head;
-    fifo_entry *tail;
-    uint32_t  size;
+    uint32_t pixels[PIXEL_FIFO_SIZE];
+    uint8_t head;
+    uint8_t tail;
+    uint32_t size;
 } fifo;
 
 /**
@@ -51,6 +50,8 @@ typedef struct {
     uint8_t fetch_x;
     uint8_t bgw_fetch_data[3];
     uint8_t fetch_entry_data[6];
+    uint8_t bgw_row[8]; // decoded color indices of the fetched tile row
+    uint8_t entry_rows[3][8]; // decoded sprite rows, already mirrored for x flip
     uint8_t map_y;
     uint8_t map_x;
     uint8_t tile_y;
@@ -75,6 +76,14 @@ typedef struct {
 
 } oam_entry;
 
+/**
+ * @brief How the visible pixels of a line are produced
+ * */
+typedef enum {
+    PPU_RENDER_FIFO, // dot by dot pixel fetcher and fifo, the accurate mode
+    PPU_RENDER_SCANLINE // whole line drawn at the start of HBLANK, mid line register writes are missed
+} ppu_render_mode;
+
 /**
  * @brief Linked list tracking sprite structures
  * */
@@ -91,6 +100,9 @@ typedef struct {
     oam_entry oam_ram[40];
     uint8_t vram[0x2000];
 
+    uint64_t sprite_lines[144]; // per visible line, bit n set when sprite n covers it, kept up to date by OAM writes
+    uint8_t sprite_lines_height; // sprite height the bits were set for, 0 to rebuild them
+
     uint8_t line_sprite_count; //0-10
     oam_line_entry *line_sprites; //linked list of current sprites on line
     oam_line_entry line_entry_array[10]; // mem to use for list
@@ -105,46 +117,94 @@ typedef struct {
     uint32_t current_frame;
     uint32_t line_ticks;
     uint32_t *video_buffer;
+
+    ppu_render_mode render_mode;
+    uint32_t xfer_end; // scanline mode: line tick at which the pixel transfer ends
+    uint8_t xfer_tiles; // scanline mode: tiles the fetcher would have started by then
+
+    uint32_t frame_skip; // 1 of every frame_skip frames is drawn, 0 and 1 draw all of them
+    uint32_t frames_skipped; // skipped in a row since the last drawn frame
+    bool skip_frame; // the current frame keeps its timing but writes no pixels
 } ppu_context;
 
-void ppu_init();
+void ppu_init(Gameboy *gb);
 
 /**
  * @brief Steps the PPU forward by single tick
  * */
-void ppu_tick(Bus *bus);
+void ppu_tick(Gameboy *gb);
+/**
+ * @brief Steps the PPU forward by a number of ticks, skipping over ticks where nothing happens
+ * */
+void ppu_run(Gameboy *gb, uint32_t ticks);
+/**
+ * @brief Number of ticks until the next mode change or LY increment
+ * */
+uint32_t ppu_ticks_to_event(Gameboy *gb);
+/**
+ * @brief True while the pixels of the current line come from the dot by dot fifo
+ * */
+bool ppu_fifo_active(Gameboy *gb);
 /**
  * @brief Writing bytes into OAM 
  * */
-void ppu_oam_write(uint16_t address, uint8_t value);
+void ppu_oam_write(Gameboy *gb, uint16_t address, uint8_t value);
+
+/**
+ * @brief Recomputes the lines every sprite covers, needed when OAM or the sprite height change as a whole
+ * */
+void ppu_sprite_lines_rebuild(Gameboy *gb);
+
+/**
+ * @brief Replaces the whole OAM, used by bulk DMA transfers
+ * */
+void ppu_oam_load(Gameboy *gb, const uint8_t *data);
 
 /**
  * @brief Reading bytes from OAM
  * */
-uint8_t ppu_oam_read(uint16_t address);
+uint8_t ppu_oam_read(Gameboy *gb, uint16_t address);
 
 /**
  * @brief Writing bytes to VRAM
  * */
-void ppu_vram_write(uint16_t address, uint8_t value);
+void ppu_vram_write(Gameboy *gb, uint16_t address, uint8_t value);
 /**
  * @brief Reading bytes from VRAM
  * */
-uint8_t ppu_vram_read(uint16_t address);
-
-ppu_context *ppu_get_context();
+uint8_t ppu_vram_read(Gameboy *gb, uint16_t address);
 
 /**
  * @brief Triggers a signal request flag inside the IF interrupt register
  * */
-void request_interrupt(Bus *bus, uint8_t interruptBit);
+void request_interrupt(Gameboy *gb, uint8_t interruptBit);
 
 /**
  * @brief Steps the clock cycle operations of the pixel fetcher
  * */
-void pipeline_process(Bus *bus);
+void pipeline_process(Gameboy *gb);
 
 /**
  * @brief empties the fifo queue
  * */
-void pipeline_fifo_reset();
+void pipeline_fifo_reset(Gameboy *gb);
+
+/**
+ * @brief Number of ticks until the pixel transfer of the current line is done
+ * */
+uint32_t pipeline_ticks_left(Gameboy *gb);
+
+/**
+ * @brief Scanline mode: works out when the pixel transfer that just started ends
+ * */
+void pipeline_schedule_line(Gameboy *gb);
+
+/**
+ * @brief Scanline mode: draws the current line in one go, same output as the fifo for unchanged registers
+ * */
+void pipeline_render_line(Gameboy *gb);
+
+/**
+ * @brief Skipped frames: ends the transfer of the current line like pipeline_render_line without drawing it
+ * */
+void pipeline_skip_line(Gameboy *gb);
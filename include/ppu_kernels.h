@@ -0,0 +1,72 @@
+/**
+ * @file ppu_kernels.h
+ * @brief Vectorized tile decode and palette mapping, picked at runtime from what the CPU supports
+ * */
+#pragma once
+
+#include <setup.h>
+
+/**
+ * @brief One implementation of the pixel kernels
+ * */
+typedef struct {
+    const char *name;
+    bool vector; // false for the portable set, the callers inline it instead of calling through the pointers
+    /**
+     * @brief Interleaves the two bitplanes of a tile row into 8 color indices, leftmost pixel first
+     * */
+    void (*decode_row)(uint8_t lo, uint8_t hi, uint8_t *indices);
+    /**
+     * @brief Maps 8 color indices to RGBA32 through a 4 entry palette
+     * */
+    void (*map_row)(const uint8_t *indices, const uint32_t *palette, uint32_t *pixels);
+} ppu_kernels;
+
+/**
+ * @brief Portable row decode, the code the tile cache used before the kernels
+ * */
+static inline void ppu_decode_row_scalar(uint8_t lo, uint8_t hi, uint8_t *indices) {
+    for (int i = 0; i < 8; i++) {
+        int bit = 7 - i;
+        indices[i] = ((lo >> bit) & 1) | (((hi >> bit) & 1) << 1);
+    }
+}
+
+static inline void ppu_map_row_scalar(const uint8_t *indices, const uint32_t *palette, uint32_t *pixels) {
+    for (int i = 0; i < 8; i++) {
+        pixels[i] = palette[indices[i] & 3];
+    }
+}
+
+/**
+ * @brief Decodes a row with the selected set, an indirect call per row only pays off for the vector ones
+ * */
+static inline void ppu_decode_row(const ppu_kernels *k, uint8_t lo, uint8_t hi, uint8_t *indices) {
+    if (k->vector) {
+        k->decode_row(lo, hi, indices);
+    } else {
+        ppu_decode_row_scalar(lo, hi, indices);
+    }
+}
+
+/**
+ * @brief Maps a row with the selected set, see ppu_decode_row
+ * */
+static inline void ppu_map_row(const ppu_kernels *k, const uint8_t *indices, const uint32_t *palette, uint32_t *pixels) {
+    if (k->vector) {
+        k->map_row(indices, palette, pixels);
+    } else {
+        ppu_map_row_scalar(indices, palette, pixels);
+    }
+}
+
+/**
+ * @brief Fastest kernels supported by the CPU, the choice is made on the first call
+ * */
+const ppu_kernels *ppu_kernels_get();
+
+/**
+ * @brief Every kernel set the CPU can run, scalar first
+ * @param count number of entries returned
+ * */
+const ppu_kernels *ppu_kernels_available(int *count);
@@ -7,9 +7,9 @@
 
 #include <setup.h>
 #include <bus.h>
-void ppu_mode_oam();
-void ppu_mode_xfer(Bus *bus);
-void ppu_mode_vblank(Bus *bus);
-void ppu_mode_hblank(Bus *bus);
+void ppu_mode_oam(Gameboy *gb);
+void ppu_mode_xfer(Gameboy *gb);
+void ppu_mode_vblank(Gameboy *gb);
+void ppu_mode_hblank(Gameboy *gb);
 
-void increment_ly(Bus *bus);
+void increment_ly(Gameboy *gb);
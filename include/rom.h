@@ -8,7 +8,55 @@
 #include <setup.h>
 #include <bus.h>
 
+/**
+ * @brief Cartridge header at 0x0100-0x014F
+ * */
+typedef struct {
+    char title[17]; // printable characters only, NUL terminated
+    uint8_t cgb_flag;
+    uint8_t cart_type;
+    uint32_t rom_size; // from the size code, 0 for unknown codes
+    uint32_t ram_size; // from the size code, MBC2 RAM isn't listed here
+    uint8_t header_checksum;
+    bool header_checksum_ok; // the boot ROM locks up on a mismatch
+    uint16_t global_checksum;
+    bool global_checksum_ok; // not checked by the hardware
+} rom_header;
+
+/**
+ * @brief ROM file mapped read only, shared by every emulator instance that loads it
+ * */
+typedef struct rom_image {
+    uint8_t *data; // never written, the mapping is read only
+    uint32_t size; // power of two, at least two banks
+    uint32_t file_size;
+    rom_header header;
+
+    // the rest belongs to rom_image_open and rom_image_release
+    bool mapped;
+    int refs;
+    uint64_t device;
+    uint64_t inode;
+    int64_t mtime;
+    struct rom_image *next;
+} rom_image;
+
+/**
+ * @brief Maps a ROM file, or takes another reference on the image if it is already loaded
+ * @return NULL if the file can't be read or is no ROM
+ * */
+rom_image *rom_image_open(const char *filename);
+
+/**
+ * @brief Drops a reference, the last one unmaps the file
+ * */
+void rom_image_release(rom_image *image);
+
+/**
+ * @brief Reads the header fields and verifies both checksums
+ * */
+void rom_header_parse(rom_header *header, const uint8_t *data, uint32_t size);
+
 bool LoadRom(Bus *bus, const char *filename);
 
 const char *select_rom_dialog();
-
@@ -0,0 +1,50 @@
+/**
+ * @file savestate.h
+ * @brief Snapshots of the whole emulated system as a versioned binary blob
+ * */
+#pragma once
+
+#include <setup.h>
+
+/**
+ * @brief Bumped whenever a section changes its layout, older states are rejected
+ * */
+#define SAVESTATE_VERSION 10
+
+/**
+ * @brief Parts of the system stored in a state, in file order
+ * */
+typedef enum {
+    SECTION_CPU,
+    SECTION_BUS,
+    SECTION_IO,
+    SECTION_WRAM,
+    SECTION_HRAM,
+    SECTION_CART_RAM,
+    SECTION_PPU,
+    SECTION_LCD,
+    SECTION_DMA,
+    SECTION_GAMEPAD,
+    SECTION_SCHED,
+    SECTION_COUNT
+} savestate_section;
+
+/**
+ * @brief Number of bytes savestate_save needs for the loaded ROM
+ * */
+size_t savestate_size(Gameboy *gb);
+
+/**
+ * @brief Writes the state into a buffer
+ * @return size_t bytes written, 0 if the buffer is too small
+ * */
+size_t savestate_save(Gameboy *gb, uint8_t *buffer, size_t size);
+
+/**
+ * @brief Restores a state written by savestate_save, the Gameboy is untouched if it is rejected
+ * @return false if the blob is damaged, from another version or from another ROM
+ * */
+bool savestate_load(Gameboy *gb, const uint8_t *buffer, size_t size);
+
+bool savestate_save_file(Gameboy *gb, const char *filename);
+bool savestate_load_file(Gameboy *gb, const char *filename);
@@ -0,0 +1,57 @@
+/**
+ * @file sched.h
+ * @brief Event scheduler, lets the CPU run ahead until a peripheral has something to report
+ * */
+#pragma once
+
+#include <setup.h>
+#include <bus.h>
+
+/**
+ * @brief Subsystems that register a deadline
+ * */
+typedef enum {
+    EVENT_DMA,
+    EVENT_TIMER,
+    EVENT_PPU,
+    EVENT_COUNT
+} sched_event;
+
+/**
+ * @brief Deadline value of a subsystem with nothing pending
+ * */
+#define SCHED_NEVER UINT64_MAX
+
+/**
+ * @brief Scheduler state, peripherals are stepped lazily up to the CPU time
+ * */
+typedef struct {
+    uint64_t cycles; // T-cycles executed by the CPU
+    uint64_t ticks; // M-cycles the peripherals have been stepped
+    uint64_t deadline[EVENT_COUNT]; // tick that has to be reached before the CPU may continue
+    uint64_t next; // CPU cycle count at which the earliest deadline has passed
+    bool syncing;
+} sched_context;
+
+void sched_init(Gameboy *gb);
+
+/**
+ * @brief Accounts the cycles of an executed instruction, catches up when a deadline has passed
+ * */
+void sched_advance(Gameboy *gb, int cycles);
+
+/**
+ * @brief Steps DMA, timer and PPU up to the start of the current instruction
+ * */
+void sched_sync(Gameboy *gb);
+
+/**
+ * @brief Collects the next deadline of every subsystem
+ * */
+void sched_reschedule(Gameboy *gb);
+
+/**
+ * @brief Cycles a halted CPU can skip, up to the next deadline where an interrupt may be raised
+ * @return multiple of 4, at least 4
+ * */
+uint32_t sched_halt_cycles(Gameboy *gb);
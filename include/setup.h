@@ -13,3 +13,8 @@
 
 #define BIT_SET(var, bit, val) ((val) ? ((var) |= (1 << (bit))) : ((var) &= ~(1 << (bit))))
 #define BIT(a, n) ((a & (1 << n)) ? 1 : 0)
+
+/**
+ * @brief Forward declaration of the main Gameboy struct, defined in emulator.h
+ * */
+typedef struct gameboy Gameboy;
@@ -0,0 +1,38 @@
+/**
+ * @file tile_cache.h
+ * @brief Tiles in VRAM decoded to one color index per pixel
+ * */
+#pragma once
+
+#include <setup.h>
+
+/**
+ * @brief Tiles in the tile data area 0x8000-0x97FF
+ * */
+#define TILE_COUNT 384
+
+/**
+ * @brief Decoded tiles, a tile is decoded again on the first read after a VRAM write
+ * */
+typedef struct {
+    uint8_t rows[TILE_COUNT][8][8]; // color index 0-3, leftmost pixel first
+    uint8_t flipped_rows[TILE_COUNT][8][8]; // same rows mirrored for x flipped sprites
+    bool valid[TILE_COUNT];
+} tile_cache;
+
+/**
+ * @brief Marks the tile holding a VRAM address for decoding
+ * */
+void tile_cache_invalidate(Gameboy *gb, uint16_t address);
+
+/**
+ * @brief Marks every tile for decoding, needed when VRAM is replaced as a whole
+ * */
+void tile_cache_reset(Gameboy *gb);
+
+/**
+ * @brief Decoded pixels of the tile row starting at a VRAM address
+ * @param address address of the first of the two bytes of the row
+ * @param flip returns the row mirrored
+ * */
+const uint8_t *tile_cache_row(Gameboy *gb, uint16_t address, bool flip);
@@ -0,0 +1,220 @@
+#include <setup.h>
+#include <emulator.h>
+#include <battery.h>
+#include <time.h>
+
+static bool page_pending(const uint64_t *bits, uint32_t page) {
+    return bits[page / 64] & (1ULL << (page % 64));
+}
+
+static bool any_pending(const uint64_t *bits) {
+    for (int i = 0; i < MBC_DIRTY_WORDS; i++) {
+        if (bits[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// every cart RAM size is a multiple of the page size
+static uint32_t page_count(battery_context *bat) {
+    return bat->ram_size / MBC_DIRTY_PAGE;
+}
+
+// the file is only created once there is something to write, called without the lock
+static bool open_file(battery_context *bat) {
+    if (bat->file) {
+        return true;
+    }
+    bat->file = fopen(bat->path, "r+b");
+    if (bat->file) {
+        return true;
+    }
+
+    // a new file gets the whole RAM so it has the size other emulators expect
+    bat->file = fopen(bat->path, "w+b");
+    if (!bat->file) {
+        fprintf(stderr, "Failed to open save file: %s\n", bat->path);
+        return false;
+    }
+    fwrite(bat->out, 1, bat->ram_size, bat->file);
+    return true;
+}
+
+static void *writer_thread(void *arg) {
+    battery_context *bat = arg;
+    uint64_t pending[MBC_DIRTY_WORDS];
+    uint8_t rtc[RTC_SAVE_SIZE];
+
+    for (;;) {
+        pthread_mutex_lock(&bat->lock);
+        while (!bat->quit && !bat->rtc_pending && !any_pending(bat->pending)) {
+            pthread_cond_wait(&bat->wake, &bat->lock);
+        }
+
+        // copy out and let the emulation hand over the next pages while this is written
+        memcpy(pending, bat->pending, sizeof(pending));
+        memset(bat->pending, 0, sizeof(bat->pending));
+        for (uint32_t page = 0; page < page_count(bat); page++) {
+            if (page_pending(pending, page)) {
+                memcpy(bat->out + page * MBC_DIRTY_PAGE, bat->shadow + page * MBC_DIRTY_PAGE, MBC_DIRTY_PAGE);
+            }
+        }
+        bool write_rtc = bat->rtc_pending;
+        memcpy(rtc, bat->rtc, sizeof(rtc));
+        bat->rtc_pending = false;
+        bool quit = bat->quit;
+        pthread_mutex_unlock(&bat->lock);
+
+        if (open_file(bat)) {
+            for (uint32_t page = 0; page < page_count(bat); page++) {
+                if (!page_pending(pending, page)) {
+                    continue;
+                }
+                fseek(bat->file, page * MBC_DIRTY_PAGE, SEEK_SET);
+                fwrite(bat->out + page * MBC_DIRTY_PAGE, 1, MBC_DIRTY_PAGE, bat->file);
+            }
+            if (write_rtc) {
+                fseek(bat->file, bat->ram_size, SEEK_SET);
+                fwrite(rtc, 1, sizeof(rtc), bat->file);
+            }
+            fflush(bat->file);
+        }
+
+        if (quit) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+// moves the dirty pages into the shadow copy and write protects them again, called with the lock held
+static bool hand_over(Gameboy *gb, bool final) {
+    battery_context *bat = gb->battery;
+    mbc_context *mbc = &gb->bus.mbc;
+    bool any = false;
+
+    for (uint32_t page = 0; page < page_count(bat); page++) {
+        if (!page_pending(mbc->dirty, page)) {
+            continue;
+        }
+        memcpy(bat->shadow + page * MBC_DIRTY_PAGE, mbc->ram + page * MBC_DIRTY_PAGE, MBC_DIRTY_PAGE);
+        bat->pending[page / 64] |= 1ULL << (page % 64);
+        any = true;
+    }
+    memset(mbc->dirty, 0, sizeof(mbc->dirty));
+
+    // the clock keeps running, its host time only matters when the game is loaded again
+    if (bat->has_rtc && (any || final)) {
+        mbc_rtc_save(mbc, gb->sched.cycles, bat->rtc, time(NULL));
+        bat->rtc_pending = true;
+    }
+
+    if (any) {
+        BusMapCart(&gb->bus);
+    }
+    return any || bat->rtc_pending;
+}
+
+bool battery_open(Gameboy *gb, const char *path) {
+    mbc_context *mbc = &gb->bus.mbc;
+
+    battery_close(gb);
+    if (!mbc->has_battery || (!mbc->ram_size && !mbc->has_rtc)) {
+        return false;
+    }
+
+    battery_context *bat = calloc(1, sizeof(battery_context));
+    snprintf(bat->path, sizeof(bat->path), "%s", path);
+    bat->ram_size = mbc->ram_size;
+    bat->has_rtc = mbc->has_rtc;
+    bat->shadow = calloc(1, bat->ram_size + 1);
+    bat->out = calloc(1, bat->ram_size + 1);
+
+    FILE *fpointer = fopen(path, "rb");
+    if (fpointer) {
+        uint8_t rtc[RTC_SAVE_SIZE];
+        size_t bytes = mbc->ram_size ? fread(mbc->ram, 1, mbc->ram_size, fpointer) : 0;
+
+        // MBC2 keeps half bytes, files from elsewhere may have the upper bits set
+        if (mbc->type == MBC_2) {
+            for (uint32_t i = 0; i < mbc->ram_size; i++) {
+                mbc->ram[i] &= 0x0F;
+            }
+        }
+        if (mbc->has_rtc && fread(rtc, 1, sizeof(rtc), fpointer) == sizeof(rtc)) {
+            mbc_rtc_load(mbc, gb->sched.cycles, rtc, time(NULL));
+        }
+        fclose(fpointer);
+        fprintf(stderr, "Loaded %zu bytes of cart RAM from: %s\n", bytes, path);
+    }
+
+    gb->battery = bat;
+    if (mbc->ram_size) {
+        memcpy(bat->shadow, mbc->ram, mbc->ram_size);
+        memcpy(bat->out, mbc->ram, mbc->ram_size);
+    }
+    mbc->track_dirty = true;
+    memset(mbc->dirty, 0, sizeof(mbc->dirty));
+    BusMapCart(&gb->bus);
+
+    pthread_mutex_init(&bat->lock, NULL);
+    pthread_cond_init(&bat->wake, NULL);
+    pthread_create(&bat->thread, NULL, writer_thread, bat);
+    return true;
+}
+
+void battery_update(Gameboy *gb) {
+    battery_context *bat = gb->battery;
+
+    if (!bat || ++bat->frames < BATTERY_FLUSH_FRAMES) {
+        return;
+    }
+
+    // the writer is copying, the pages stay dirty until the next frame
+    if (pthread_mutex_trylock(&bat->lock) != 0) {
+        return;
+    }
+    if (hand_over(gb, false)) {
+        pthread_cond_signal(&bat->wake);
+    }
+    pthread_mutex_unlock(&bat->lock);
+    bat->frames = 0;
+}
+
+void battery_close(Gameboy *gb) {
+    battery_context *bat = gb->battery;
+
+    if (!bat) {
+        return;
+    }
+
+    pthread_mutex_lock(&bat->lock);
+    hand_over(gb, true);
+    bat->quit = true;
+    pthread_cond_signal(&bat->wake);
+    pthread_mutex_unlock(&bat->lock);
+    pthread_join(bat->thread, NULL);
+
+    if (bat->file) {
+        fclose(bat->file);
+    }
+    pthread_mutex_destroy(&bat->lock);
+    pthread_cond_destroy(&bat->wake);
+    free(bat->shadow);
+    free(bat->out);
+    free(bat);
+
+    gb->battery = NULL;
+    gb->bus.mbc.track_dirty = false;
+    BusMapCart(&gb->bus);
+}
+
+void battery_path(char *path, size_t size, const char *rom_path) {
+    const char *dot = strrchr(rom_path, '.');
+    const char *slash = strrchr(rom_path, '/');
+    int length = (dot && (!slash || dot > slash)) ? (int)(dot - rom_path) : (int)strlen(rom_path);
+
+    snprintf(path, size, "%.*s.sav", length, rom_path);
+}
@@ -0,0 +1,587 @@
+#include <setup.h>
+#include <emulator.h>
+#include <rom.h>
+#include <ppu_kernels.h>
+#include <savestate.h>
+#include <sched.h>
+#include <math.h>
+#include <time.h>
+
+#define DEFAULT_FRAMES 600
+#define DEFAULT_RUNS 5
+#define DEFAULT_TOLERANCE 5.0
+#define MICRO_ITERATIONS 1000000
+#define MAX_RUNS 64
+#define KERNEL_ROWS 4096
+#define KERNEL_ITERATIONS 4000000
+
+/**
+ * @brief One measured value, collected once per run
+ * */
+typedef enum {
+    METRIC_FPS,
+    METRIC_IPS,
+    METRIC_CPU_STEP,
+    METRIC_PPU_TICK,
+    METRIC_BUS_READ,
+    METRIC_PPU_ALLOCATIONS,
+    METRIC_COUNT
+} bench_metric;
+
+static const struct {
+    const char *name;
+    bool higher_is_better;
+} metric_info[METRIC_COUNT] = {
+    [METRIC_FPS] = {"fps", true},
+    [METRIC_IPS] = {"ips", true},
+    [METRIC_CPU_STEP] = {"ns_per_cpu_step", false},
+    [METRIC_PPU_TICK] = {"ns_per_ppu_tick", false},
+    [METRIC_BUS_READ] = {"ns_per_bus_read", false},
+    [METRIC_PPU_ALLOCATIONS] = {"ppu_tick_allocations", false},
+};
+
+typedef struct {
+    double mean;
+    double stddev;
+    double min;
+    double max;
+} bench_summary;
+
+typedef struct {
+    const char *rom;
+    uint32_t frames;
+    uint32_t runs;
+    const char *output;
+    const char *baseline;
+    double tolerance;
+    bool scanline;
+    uint32_t frame_skip;
+    bool bulk_dma;
+    bool no_idle_skip;
+    bool kernels;
+} bench_options;
+
+static volatile uint8_t bus_sink;
+
+// the Makefile links gb-bench with --wrap, every allocation made by the core goes through these
+static uint64_t heap_allocations;
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    heap_allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    heap_allocations++;
+    return __real_calloc(count, size);
+}
+static volatile uint32_t kernel_sink;
+
+static void usage(const char *name) {
+    printf("usage: %s [options] rom.gb\n", name);
+    printf("       %s --kernels [--runs N] [--output FILE]\n", name);
+    printf("  --frames N        frames per run (default %d)\n", DEFAULT_FRAMES);
+    printf("  --runs N          number of runs (default %d, max %d)\n", DEFAULT_RUNS, MAX_RUNS);
+    printf("  --output FILE     write the JSON report to FILE instead of stdout\n");
+    printf("  --baseline FILE   compare against an earlier report, exit code 3 on a regression\n");
+    printf("  --tolerance PCT   allowed slowdown against the baseline (default %.0f)\n", DEFAULT_TOLERANCE);
+    printf("  --scanline        use the scanline renderer instead of the fifo\n");
+    printf("  --frame-skip N    draw 1 of every N frames\n");
+    printf("  --bulk-dma        copy OAM DMA transfers in one go\n");
+    printf("  --no-idle-skip    run polling loops instead of jumping to the next event\n");
+    printf("  --kernels         time the tile decode and palette kernels, no ROM needed\n");
+}
+
+static bool parse_options(bench_options *opt, int argc, char *argv[]) {
+    memset(opt, 0, sizeof(*opt));
+    opt->frames = DEFAULT_FRAMES;
+    opt->runs = DEFAULT_RUNS;
+    opt->tolerance = DEFAULT_TOLERANCE;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (arg[0] != '-') {
+            opt->rom = arg;
+            continue;
+        }
+        if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+            return false;
+        }
+        if (!strcmp(arg, "--scanline")) {
+            opt->scanline = true;
+            continue;
+        }
+        if (!strcmp(arg, "--bulk-dma")) {
+            opt->bulk_dma = true;
+            continue;
+        }
+        if (!strcmp(arg, "--no-idle-skip")) {
+            opt->no_idle_skip = true;
+            continue;
+        }
+        if (!strcmp(arg, "--kernels")) {
+            opt->kernels = true;
+            continue;
+        }
+        if (!value) {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return false;
+        }
+        i++;
+
+        if (!strcmp(arg, "--frames")) {
+            opt->frames = strtoul(value, NULL, 10);
+        } else if (!strcmp(arg, "--runs")) {
+            opt->runs = strtoul(value, NULL, 10);
+        } else if (!strcmp(arg, "--output")) {
+            opt->output = value;
+        } else if (!strcmp(arg, "--baseline")) {
+            opt->baseline = value;
+        } else if (!strcmp(arg, "--frame-skip")) {
+            opt->frame_skip = strtoul(value, NULL, 10);
+        } else if (!strcmp(arg, "--tolerance")) {
+            opt->tolerance = strtod(value, NULL);
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return false;
+        }
+    }
+
+    if (!opt->rom && !opt->kernels) {
+        fprintf(stderr, "No ROM given\n");
+        return false;
+    }
+    if (!opt->frames || !opt->runs || opt->runs > MAX_RUNS) {
+        fprintf(stderr, "Invalid frame or run count\n");
+        return false;
+    }
+    return true;
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Runs the whole system for the requested frames, the numbers users care about
+ * */
+static void bench_frames(Gameboy *gb, uint32_t frames, double *fps, double *ips) {
+    uint64_t steps = 0;
+    uint64_t skips = gb->idle.skips;
+    uint64_t skipped = gb->idle.skipped_instructions;
+    double start = now_seconds();
+
+    for (uint32_t i = 0; i < frames; i++) {
+        uint32_t prev_frame = gb->ppu.current_frame;
+
+        while (prev_frame == gb->ppu.current_frame) {
+            gb_step(gb);
+            steps++;
+        }
+    }
+
+    double seconds = now_seconds() - start;
+    // a skip is one step standing for every instruction of the loop iterations it jumped over
+    uint64_t instructions = steps - (gb->idle.skips - skips) + (gb->idle.skipped_instructions - skipped);
+    *fps = frames / seconds;
+    *ips = instructions / seconds;
+}
+
+/**
+ * @brief CPU share of a real gb_step, the peripheral work of the same steps is replayed on its own and subtracted
+ * @details CPUStep alone with the peripherals frozen keeps a ROM that polls LY in its loop forever
+ * */
+static double bench_cpu_step(Gameboy *gb) {
+    static uint32_t step_cycles[MICRO_ITERATIONS];
+    size_t size = savestate_size(gb);
+    uint8_t *state = malloc(size);
+
+    savestate_save(gb, state, size);
+
+    double start = now_seconds();
+    for (int i = 0; i < MICRO_ITERATIONS; i++) {
+        step_cycles[i] = CPUStep(&gb->cpu, &gb->bus);
+        sched_advance(gb, step_cycles[i]);
+    }
+    double both = now_seconds() - start;
+
+    savestate_load(gb, state, size);
+    start = now_seconds();
+    for (int i = 0; i < MICRO_ITERATIONS; i++) {
+        sched_advance(gb, step_cycles[i]);
+    }
+    double peripherals = now_seconds() - start;
+
+    // the other benchmarks continue from where the frame run left off
+    savestate_load(gb, state, size);
+    free(state);
+
+    return (both - peripherals) * 1e9 / MICRO_ITERATIONS;
+}
+
+static double bench_ppu_tick(Gameboy *gb, double *allocations) {
+    uint64_t before = heap_allocations;
+    double start = now_seconds();
+
+    for (int i = 0; i < MICRO_ITERATIONS; i++) {
+        ppu_tick(gb);
+    }
+
+    double seconds = now_seconds() - start;
+    *allocations = heap_allocations - before;
+    return seconds * 1e9 / MICRO_ITERATIONS;
+}
+
+/**
+ * @brief Reads from pseudo random addresses over the whole address space
+ * */
+static double bench_bus_read(Gameboy *gb) {
+    static uint16_t addresses[4096];
+    uint32_t seed = 0x12345678;
+
+    for (int i = 0; i < 4096; i++) {
+        seed = seed * 1664525 + 1013904223;
+        addresses[i] = seed >> 16;
+    }
+
+    uint8_t sum = 0;
+    double start = now_seconds();
+
+    for (int i = 0; i < MICRO_ITERATIONS; i++) {
+        sum += BusRead(&gb->bus, addresses[i & 4095]);
+    }
+
+    double seconds = now_seconds() - start;
+    bus_sink = sum;
+    return seconds * 1e9 / MICRO_ITERATIONS;
+}
+
+/**
+ * @brief The per pixel decode and palette lookup the pipeline used before the kernels
+ * */
+static void reference_decode_row(uint8_t lo, uint8_t hi, uint8_t *indices) {
+    for (int bit = 7; bit >= 0; bit--) {
+        uint8_t low = !!(lo & (1 << bit));
+        uint8_t high = !!(hi & (1 << bit)) << 1;
+        indices[7 - bit] = high | low;
+    }
+}
+
+static void reference_map_row(const uint8_t *indices, const uint32_t *palette, uint32_t *pixels) {
+    for (int i = 0; i < 8; i++) {
+        pixels[i] = palette[indices[i]];
+    }
+}
+
+static const ppu_kernels reference_kernels = {"reference", false, reference_decode_row, reference_map_row};
+
+// every set goes through the pointers, the reference included, so they are timed on equal terms
+static void kernel_row(const ppu_kernels *k, uint8_t lo, uint8_t hi, const uint32_t *palette, uint32_t *pixels) {
+    uint8_t indices[8];
+
+    k->decode_row(lo, hi, indices);
+    k->map_row(indices, palette, pixels);
+}
+
+/**
+ * @brief Decodes and maps pseudo random tile rows
+ * */
+static double bench_kernel_set(const ppu_kernels *k, const uint16_t *rows, const uint32_t *palette) {
+    uint32_t pixels[8];
+    uint32_t sum = 0;
+    double start = now_seconds();
+
+    for (int i = 0; i < KERNEL_ITERATIONS; i++) {
+        uint16_t row = rows[i & (KERNEL_ROWS - 1)];
+        kernel_row(k, row & 0xFF, row >> 8, palette, pixels);
+        sum += pixels[i & 7];
+    }
+
+    double seconds = now_seconds() - start;
+    kernel_sink = sum;
+    return seconds * 1e9 / KERNEL_ITERATIONS;
+}
+
+/**
+ * @brief Every lo/hi pair must give the same pixels as the reference
+ * */
+static bool check_kernel_set(const ppu_kernels *k, const uint32_t *palette) {
+    for (int row = 0; row < 0x10000; row++) {
+        uint32_t expected[8], pixels[8];
+
+        kernel_row(&reference_kernels, row & 0xFF, row >> 8, palette, expected);
+        kernel_row(k, row & 0xFF, row >> 8, palette, pixels);
+        if (memcmp(expected, pixels, sizeof(pixels))) {
+            fprintf(stderr, "%s kernels differ from the reference for %04X\n", k->name, row);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bench_summary summarize(const double *values, uint32_t count) {
+    bench_summary summary = {0, 0, values[0], values[0]};
+
+    for (uint32_t i = 0; i < count; i++) {
+        summary.mean += values[i];
+        if (values[i] < summary.min) summary.min = values[i];
+        if (values[i] > summary.max) summary.max = values[i];
+    }
+    summary.mean /= count;
+
+    if (count > 1) {
+        double sq = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            sq += (values[i] - summary.mean) * (values[i] - summary.mean);
+        }
+        summary.stddev = sqrt(sq / (count - 1));
+    }
+    return summary;
+}
+
+/**
+ * @brief Finds the mean of a metric in an earlier report, only understands the format written below
+ * */
+static bool baseline_mean(const char *json, const char *metric, double *mean) {
+    char key[64];
+    snprintf(key, sizeof(key), "\"%s\": {", metric);
+
+    const char *pos = strstr(json, key);
+    if (!pos) {
+        return false;
+    }
+
+    // only inside the metric's own object, a metric missing from an older report must not find the next one
+    const char *end = strchr(pos, '}');
+    pos = strstr(pos, "\"mean\"");
+    if (!pos || !end || pos > end) {
+        return false;
+    }
+    return sscanf(pos + strlen("\"mean\""), " : %lf", mean) == 1;
+}
+
+/**
+ * @brief Writes a quoted JSON string, paths may contain quotes and Windows backslashes
+ * */
+static void json_string(FILE *out, const char *value) {
+    fputc('"', out);
+    for (const unsigned char *c = (const unsigned char *)value; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(out, "\\u%04x", *c);
+        } else {
+            fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static char *read_file(const char *filename) {
+    FILE *fpointer = fopen(filename, "rb");
+    if (!fpointer) {
+        return NULL;
+    }
+
+    fseek(fpointer, 0, SEEK_END);
+    long fsize = ftell(fpointer);
+    fseek(fpointer, 0, SEEK_SET);
+
+    char *data = malloc(fsize + 1);
+    size_t bytesRead = fread(data, 1, fsize, fpointer);
+    data[bytesRead] = '\0';
+
+    fclose(fpointer);
+    return data;
+}
+
+static FILE *open_output(const bench_options *opt) {
+    if (!opt->output) {
+        return stdout;
+    }
+
+    FILE *out = fopen(opt->output, "w");
+    if (!out) {
+        fprintf(stderr, "Failed to open %s\n", opt->output);
+    }
+    return out;
+}
+
+/**
+ * @brief Reports every kernel set the CPU can run next to the scalar code it replaced
+ * */
+static int bench_kernels(const bench_options *opt) {
+    static const uint32_t palette[4] = {0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000};
+    static uint16_t rows[KERNEL_ROWS];
+    static double values[MAX_RUNS];
+    uint32_t seed = 0x12345678;
+
+    for (int i = 0; i < KERNEL_ROWS; i++) {
+        seed = seed * 1664525 + 1013904223;
+        rows[i] = seed >> 16;
+    }
+
+    int count;
+    const ppu_kernels *sets = ppu_kernels_available(&count);
+    for (int i = 0; i < count; i++) {
+        if (!check_kernel_set(&sets[i], palette)) {
+            return 2;
+        }
+    }
+
+    FILE *out = open_output(opt);
+    if (!out) {
+        return 1;
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"runs\": %u,\n", opt->runs);
+    fprintf(out, "  \"selected\": \"%s\",\n", ppu_kernels_get()->name);
+    fprintf(out, "  \"kernels\": [\n");
+
+    // index -1 is the reference code
+    for (int i = -1; i < count; i++) {
+        const ppu_kernels *k = (i < 0) ? &reference_kernels : &sets[i];
+        const char *name = k->name;
+
+        for (uint32_t run = 0; run < opt->runs; run++) {
+            values[run] = bench_kernel_set(k, rows, palette);
+        }
+
+        bench_summary summary = summarize(values, opt->runs);
+        fprintf(stderr, "%-10s %.2f ns/row\n", name, summary.mean);
+        fprintf(out, "    {\"name\": \"%s\", \"ns_per_row\": {\"mean\": %.3f, \"stddev\": %.3f, \"min\": %.3f, \"max\": %.3f}}%s\n",
+                name, summary.mean, summary.stddev, summary.min, summary.max, (i + 1 < count) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    bench_options opt;
+    if (!parse_options(&opt, argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (opt.kernels) {
+        return bench_kernels(&opt);
+    }
+
+    static Gameboy gb;
+    static double values[METRIC_COUNT][MAX_RUNS];
+
+    for (uint32_t run = 0; run < opt.runs; run++) {
+        gb_init(&gb);
+        if (!LoadRom(&gb.bus, opt.rom)) {
+            fprintf(stderr, "Failed to load ROM: %s\n", opt.rom);
+            gb_free(&gb);
+            return 1;
+        }
+        if (opt.scanline) {
+            gb_set_render_mode(&gb, PPU_RENDER_SCANLINE);
+        }
+        gb_set_frame_skip(&gb, opt.frame_skip);
+        gb_set_dma_bulk(&gb, opt.bulk_dma);
+        gb_set_idle_skip(&gb, !opt.no_idle_skip);
+
+        bench_frames(&gb, opt.frames, &values[METRIC_FPS][run], &values[METRIC_IPS][run]);
+        values[METRIC_CPU_STEP][run] = bench_cpu_step(&gb);
+        values[METRIC_PPU_TICK][run] = bench_ppu_tick(&gb, &values[METRIC_PPU_ALLOCATIONS][run]);
+        values[METRIC_BUS_READ][run] = bench_bus_read(&gb);
+
+        fprintf(stderr, "run %u: %.1f fps, %.2f M instructions/s\n",
+                run + 1, values[METRIC_FPS][run], values[METRIC_IPS][run] / 1e6);
+        gb_free(&gb);
+    }
+
+    bench_summary summary[METRIC_COUNT];
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        summary[i] = summarize(values[i], opt.runs);
+    }
+
+    // compare before writing, the output may overwrite the baseline file
+    double base[METRIC_COUNT];
+    bool has_base[METRIC_COUNT] = {false};
+    int regressions = 0;
+
+    if (opt.baseline) {
+        char *json = read_file(opt.baseline);
+        if (!json) {
+            fprintf(stderr, "Failed to read baseline: %s\n", opt.baseline);
+            return 1;
+        }
+
+        for (int i = 0; i < METRIC_COUNT; i++) {
+            has_base[i] = baseline_mean(json, metric_info[i].name, &base[i]);
+            // no percentage of zero, a count that was zero regresses as soon as it isn't
+            if (has_base[i] && base[i] == 0 && !metric_info[i].higher_is_better) {
+                bool regressed = summary[i].mean > 0;
+
+                regressions += regressed;
+                fprintf(stderr, "%-16s %12.2f -> %12.2f%s\n", metric_info[i].name,
+                        base[i], summary[i].mean, regressed ? " REGRESSION" : "");
+                continue;
+            }
+            if (!has_base[i] || base[i] <= 0) {
+                has_base[i] = false;
+                continue;
+            }
+
+            double change = (summary[i].mean - base[i]) * 100.0 / base[i];
+            double slowdown = metric_info[i].higher_is_better ? -change : change;
+            bool regressed = slowdown > opt.tolerance;
+
+            regressions += regressed;
+            fprintf(stderr, "%-16s %12.2f -> %12.2f (%+.1f%%)%s\n", metric_info[i].name,
+                    base[i], summary[i].mean, change, regressed ? " REGRESSION" : "");
+        }
+        free(json);
+    }
+
+    FILE *out = open_output(&opt);
+    if (!out) {
+        return 1;
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"rom\": ");
+    json_string(out, opt.rom);
+    fprintf(out, ",\n");
+    fprintf(out, "  \"frames\": %u,\n", opt.frames);
+    fprintf(out, "  \"runs\": %u,\n", opt.runs);
+    fprintf(out, "  \"renderer\": \"%s\",\n", opt.scanline ? "scanline" : "fifo");
+    fprintf(out, "  \"frame_skip\": %u,\n", opt.frame_skip > 1 ? opt.frame_skip : 1);
+    fprintf(out, "  \"bulk_dma\": %s,\n", opt.bulk_dma ? "true" : "false");
+    fprintf(out, "  \"idle_skip\": %s,\n", opt.no_idle_skip ? "false" : "true");
+    if (opt.baseline) {
+        fprintf(out, "  \"baseline\": {\"file\": ");
+        json_string(out, opt.baseline);
+        fprintf(out, ", \"tolerance\": %.1f, \"regressions\": %d},\n", opt.tolerance, regressions);
+    }
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        fprintf(out, "  \"%s\": {\"mean\": %.3f, \"stddev\": %.3f, \"min\": %.3f, \"max\": %.3f, \"values\": [",
+                metric_info[i].name, summary[i].mean, summary[i].stddev, summary[i].min, summary[i].max);
+        for (uint32_t run = 0; run < opt.runs; run++) {
+            fprintf(out, "%s%.3f", run ? ", " : "", values[i][run]);
+        }
+        fprintf(out, "]}%s\n", (i + 1 < METRIC_COUNT) ? "," : "");
+    }
+    fprintf(out, "}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    return regressions ? 3 : 0;
+}
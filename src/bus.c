@@ -4,139 +4,148 @@
 #include <iogm.h>
 #include <ppu.h>
 #include <dma.h>
+#include <lcd.h>
+#include <sched.h>
 
-uint8_t BusRead(Bus *bus, uint16_t address) {
-    if (address == 0xFF04) {
-        return (bus->internal_divider >> 8);
+// reads from disabled or out of range memory
+static uint8_t open_bus[0x100] = {
+    [0 ... 0xFF] = 0xFF
+};
+
+void BusMapCart(Bus *bus) {
+    mbc_context *mbc = &bus->mbc;
+
+    for (int page = 0x00; page < 0x40; page++) {
+	bus->read_page[page] = mbc->rom0 ? &mbc->rom0[page << 8] : open_bus;
     }
-    //ROM BANK 0
-    if (address < 0x4000) {
-	uint32_t bank = 0;
-	if (bus->banking_mode == 1) {
-	    bank = (bus->bank_upper << 5);
-	}
-        return bus->memory[address + (bank * 0x4000)];
+    for (int page = 0x40; page < 0x80; page++) {
+	bus->read_page[page] = mbc->romx ? &mbc->romx[(page - 0x40) << 8] : open_bus;
     }
-    //ROM BANK X
-    if (address < 0x8000) {
-	uint32_t bank = bus->current_bank;
-	if (bus->banking_mode == 0) {
-	    bank |= (bus->bank_upper << 5);
+    // disabled RAM, MBC2 and the clock registers go through the mapper, so do clean pages a battery file tracks
+    for (int page = 0xA0; page < 0xC0; page++) {
+	uint8_t *ram = mbc->ram_window ? &mbc->ram_window[(page - 0xA0) << 8] : NULL;
+	bus->read_page[page] = ram;
+	bus->write_page[page] = (ram && mbc_ram_writable(mbc, ram)) ? ram : NULL;
+    }
+}
+
+void BusUpdateMap(Bus *bus) {
+    Gameboy *gb = gb_from_bus(bus);
+
+    for (int page = 0; page < 0x100; page++) {
+	uint16_t address = page << 8;
+	uint8_t *read = NULL;
+	uint8_t *write = NULL;
+
+	if (address >= 0x8000 && address < 0xA000) {
+	    // writes go through the handler to keep the ppu in sync
+	    read = &gb->ppu.vram[address - 0x8000];
+	} else if (address >= 0xC000 && address < 0xE000) {
+	    read = write = &bus->wram[address - 0xC000];
+	} else if (address >= 0xE000 && address < 0xFE00) {
+	    read = write = &bus->wram[address - 0xE000];
 	}
+	// OAM and IO stay on the handlers
+
+	bus->read_page[page] = read;
+	bus->write_page[page] = write;
+    }
+
+    BusMapCart(bus);
+}
 
-	uint32_t offset = (address - 0x4000) + (bank * 0x4000);
-	if (offset >= 0x200000) return 0xFF;
+uint8_t BusReadHandler(Bus *bus, uint16_t address) {
+    Gameboy *gb = gb_from_bus(bus);
 
-	return bus->memory[offset];
+    //ROM, always mapped once a ROM is loaded
+    if (address < 0x8000) {
+        return 0xFF;
     }
     //VRAM
     if (address < 0xA000) {
         //char map data
-        return ppu_vram_read(address);
+        return ppu_vram_read(gb, address);
     }
     //EXTERNAL CART RAM
     if (address < 0xC000) {
-	if (!bus->ram_enabled) {
-	    return 0xFF;
-	}
-	uint32_t ram_bank = 0;
-	if (bus->banking_mode == 1) {
-	    ram_bank = bus->bank_upper;
-	}
-
-	return bus->memory[0x100000 + (ram_bank * 0x2000) + (address - 0xA000)];
+        return mbc_ram_read(&bus->mbc, address);
     }
     //WRAM
     if (address < 0xE000) {
-        return bus->memory[0x110000 + (address - 0xC000)]; //shitty ahh method but works
+        return bus->wram[address - 0xC000];
     }
     //ECHORAM
     if (address < 0xFE00) {
-        // return bus->memory[address < 0x2000];
-	return bus->memory[0x110000 + (address - 0xE000)];
+	return bus->wram[address - 0xE000];
     }
     //OAM
     if (address < 0xFEA0) {
-        if (dma_transfering()) {
+        sched_sync(gb);
+        if (dma_transfering(gb)) {
             return 0xFF;
         }
-        return ppu_oam_read(address);
+        return ppu_oam_read(gb, address);
     }
     //Unusable
     if (address < 0xFF00) {
         return 0xFF;
     }
     //IO registers
+    if (address < 0xFF80) {
+        return IORead(gb, address - 0xFF00);
+    }
+    //HRAM
     if (address < 0xFFFF) {
-        return IORead(&bus->io, address - 0xFF00);
+        return bus->hram[address - 0xFF80];
     }
     //Interrupt enable register
-    return IORead(&bus->io, 0xFF);
-    
+    return bus->io.registers[0xFF];
 }
 
-void BusWrite(Bus *bus, uint16_t address, uint8_t value) {
-    if (address == 0xFF04) {
-        bus->internal_divider = 0;
-        bus->io.registers[0x04] = 0;
-        return;
-    }
+void BusWriteHandler(Bus *bus, uint16_t address, uint8_t value) {
+    Gameboy *gb = gb_from_bus(bus);
+
 
     // MBC
-    if (address < 0x2000) {
-	bus->ram_enabled = ((value & 0x0F) == 0x0A) ? 1 : 0;
-	return;
-    }
-    if (address < 0x4000) {
-        uint8_t bank = value & 0x1F;
-        if (bank == 0) bank = 1;
-        bus->current_bank = bank;
-        return;
-    }
-    if (address < 0x6000) {
-	bus->bank_upper = value & 0x03;
-	return;
-    }
-    if (address < 0x8000) {
-	bus->banking_mode = value & 0x01;
-	return;
-    }
-    //ROM - no writes
     if (address < 0x8000) {
+        if (mbc_write(&bus->mbc, address, value, gb->sched.cycles)) {
+            BusMapCart(bus);
+        }
         return;
     }
     //VRAM
     if (address < 0xA000) {
-        ppu_vram_write(address, value);
+        // only the pixel transfer reads vram, other modes don't reach it before their deadline
+        if (LCDS_MODE(gb) == MODE_XFER) {
+            sched_sync(gb);
+        }
+        ppu_vram_write(gb, address, value);
         return;
     }
     //EXTERNAL RAM
     if (address < 0xC000) {
-	if (!bus->ram_enabled) return;
-
-	uint32_t ram_bank = 0;
-	if (bus->banking_mode == 1) {
-	    ram_bank = bus->bank_upper;
-	}
-	bus->memory[0x100000 + (ram_bank * 0x2000) + (address - 0xA000)] = value;
+        if (mbc_ram_write(&bus->mbc, address, value, gb->sched.cycles)) {
+            BusMapCart(bus);
+        }
         return;
     }
     //WRAM
     if (address <0xE000) {
-        bus->memory[0x110000 + (address - 0xC000)] = value; //shitty ahh method but works
+        bus->wram[address - 0xC000] = value;
         return;
     }
     //ECHORAM
     if (address < 0xFE00) {
-	bus->memory[0x110000 + (address - 0xE000)] = value;
+	bus->wram[address - 0xE000] = value;
         return;
     }
     // OAM
     if (address < 0xFEA0) {
-        if (dma_transfering()) {
+        sched_sync(gb);
+        if (dma_transfering(gb)) {
             return;
         }
-        ppu_oam_write(address, value);
+        ppu_oam_write(gb, address, value);
         return;
     }
     //Unusable
@@ -149,56 +158,100 @@ void BusWrite(Bus *bus, uint16_t address, uint8_t value) {
     //     fflush(stdout);
     //
     //
-    //     IOWrite(&bus->io, 0x02, value & 0x7F);
+    //     IOWrite(gb, 0x02, value & 0x7F);
     //     bus->io.registers[0x0F] |= 0x08;
     //     bus->io.registers[0xFF] |= 0x08; 
     //     return; 
     // }
 
     //IO registers
+    if (address < 0xFF80) {
+        IOWrite(gb, address - 0xFF00, value);
+        return;
+    }
+    //HRAM
     if (address < 0xFFFF) {
-        IOWrite(&bus->io, address - 0xFF00, value);
+        bus->hram[address - 0xFF80] = value;
         return;
     }
-    //Interrupt enable
-    IOWrite(&bus->io, 0xFF, value);
-    
-    // bus->memory[address] = value;
+    //Interrupt enable, only the 5 interrupt bits exist
+    bus->io.registers[0xFF] = value & 0x1F;
 }
 
-uint16_t BusRead16(Bus *bus, uint16_t address) {
-    uint16_t low = BusRead(bus, address);
-    uint16_t high = BusRead(bus, address + 1);
-    return (high << 8) | low;
+// divider bit whose falling edge clocks TIMA
+static int TimerBit(uint8_t tac) {
+    switch (tac & 0x03) {
+        case 0: return 9;
+        case 1: return 3;
+        case 2: return 5;
+        default: return 7;
+    }
 }
 
-void TimerStep(Bus *bus, int cycles) {
+// adds a number of edges to TIMA, reloading from TMA on every overflow
+static void TimerCount(Bus *bus, uint32_t edges) {
+    uint8_t tima = bus->io.registers[0x05];
+    uint8_t tma = bus->io.registers[0x06];
+
+    if (edges < (uint32_t)(0x100 - tima)) {
+        bus->io.registers[0x05] = tima + edges;
+        return;
+    }
 
+    // first overflow, after that TIMA runs from TMA
+    edges -= 0x100 - tima;
+    bus->io.registers[0x05] = tma + (edges % (0x100 - tma));
+    bus->io.registers[0x0F] |= 0x04;
+}
+
+void TimerStep(Bus *bus, int cycles) {
     uint8_t tac = bus->io.registers[0x07];
-    int bit = 0;
-    switch (tac & 0x03) {
-        case 0: bit = 9; break;
-        case 1: bit = 3; break;
-        case 2: bit = 5; break;
-        case 3: bit = 7; break;
-    }
-
-    for (int i = 0; i < cycles; i++) {
-        bool enabled = (tac & 0x04) != 0;
-        bool signal_before = enabled && ((bus->internal_divider >> bit) & 1);
-
-        bus->internal_divider++;
-        
-        bool signal_after = enabled && ((bus->internal_divider >> bit) & 1);
-
-        if (signal_before && !signal_after) {
-            if (bus->io.registers[0x05] == 0xFF) {
-                bus->io.registers[0x05] = bus->io.registers[0x06];
-                bus->io.registers[0x0F] |= 0x04;
-            } else {
-                bus->io.registers[0x05]++;
-            }
+
+    if (tac & 0x04) {
+        // falling edges of the selected bit are the multiples of its period passed
+        int shift = TimerBit(tac) + 1;
+        uint32_t from = bus->internal_divider;
+        uint32_t edges = ((from + cycles) >> shift) - (from >> shift);
+
+        if (edges) {
+            TimerCount(bus, edges);
         }
     }
+
+    bus->internal_divider += cycles;
     bus->io.registers[0x04] = (bus->internal_divider >> 8);
 }
+
+void TimerResetDivider(Bus *bus) {
+    uint8_t tac = bus->io.registers[0x07];
+
+    // the selected bit drops to 0 with the rest of the divider
+    if ((tac & 0x04) && ((bus->internal_divider >> TimerBit(tac)) & 1)) {
+        TimerCount(bus, 1);
+    }
+
+    bus->internal_divider = 0;
+    bus->io.registers[0x04] = 0;
+}
+
+uint8_t TimerReadDivider(Gameboy *gb, uint16_t address) {
+    return gb->bus.internal_divider >> 8;
+}
+
+void TimerWriteDivider(Gameboy *gb, uint16_t address, uint8_t value) {
+    TimerResetDivider(&gb->bus);
+}
+
+uint32_t TimerTicksToOverflow(Bus *bus) {
+    uint8_t tac = bus->io.registers[0x07];
+    if (!(tac & 0x04)) {
+        return 0;
+    }
+
+    // TIMA counts on every falling edge of the selected divider bit
+    uint32_t period = 1 << (TimerBit(tac) + 1);
+    uint32_t first_edge = period - (bus->internal_divider & (period - 1));
+    uint32_t overflow = first_edge + (0xFF - bus->io.registers[0x05]) * period;
+
+    return (overflow + 3) / 4;
+}
@@ -5,6 +5,560 @@
 #include <iogm.h>
 #include <cpu_ops.h>
 #include <cpu_prefix.h>
+#include <sched.h>
+#include <idle.h>
+
+// GCC and clang dispatch through label tables, everything else through function tables
+#if defined(__GNUC__) && !defined(CPU_NO_COMPUTED_GOTO)
+#define CPU_COMPUTED_GOTO
+#endif
+
+/*
+ * Main opcode table
+ * OP(opcode, cycles, cycles when the branch is taken, handler body)
+ * Bodies mark a taken branch with BRANCH_TAKEN, the cycle cost is looked up afterwards.
+ */
+#define CPU_OPCODES(OP) \
+    /* NOP */ \
+    OP(0x00, 4, 4, ) \
+ \
+    /* XOR */ \
+    OP(0xA8, 4, 4, op_xor(cpu, cpu->b)) \
+    OP(0xA9, 4, 4, op_xor(cpu, cpu->c)) \
+    OP(0xAA, 4, 4, op_xor(cpu, cpu->d)) \
+    OP(0xAB, 4, 4, op_xor(cpu, cpu->e)) \
+    OP(0xAC, 4, 4, op_xor(cpu, cpu->h)) \
+    OP(0xAD, 4, 4, op_xor(cpu, cpu->l)) \
+    OP(0xAE, 8, 8, op_xor(cpu, BusRead(bus, cpu->hl))) \
+    OP(0xAF, 4, 4, op_xor(cpu, cpu->a)) \
+    OP(0xEE, 8, 8, op_xor(cpu, BusRead(bus, cpu->pc++))) \
+ \
+    /* AND */ \
+    OP(0xA0, 4, 4, op_and(cpu, cpu->b)) \
+    OP(0xA1, 4, 4, op_and(cpu, cpu->c)) \
+    OP(0xA2, 4, 4, op_and(cpu, cpu->d)) \
+    OP(0xA3, 4, 4, op_and(cpu, cpu->e)) \
+    OP(0xA4, 4, 4, op_and(cpu, cpu->h)) \
+    OP(0xA5, 4, 4, op_and(cpu, cpu->l)) \
+    OP(0xA6, 8, 8, op_and(cpu, BusRead(bus, cpu->hl))) \
+    OP(0xA7, 4, 4, op_and(cpu, cpu->a)) \
+    OP(0xE6, 8, 8, op_and(cpu, BusRead(bus, cpu->pc++))) \
+ \
+    /* OR */ \
+    OP(0xB0, 4, 4, op_or(cpu, cpu->b)) \
+    OP(0xB1, 4, 4, op_or(cpu, cpu->c)) \
+    OP(0xB2, 4, 4, op_or(cpu, cpu->d)) \
+    OP(0xB3, 4, 4, op_or(cpu, cpu->e)) \
+    OP(0xB4, 4, 4, op_or(cpu, cpu->h)) \
+    OP(0xB5, 4, 4, op_or(cpu, cpu->l)) \
+    OP(0xB6, 8, 8, op_or(cpu, BusRead(bus, cpu->hl))) \
+    OP(0xB7, 4, 4, op_or(cpu, cpu->a)) \
+    OP(0xF6, 8, 8, op_or(cpu, BusRead(bus, cpu->pc++))) \
+ \
+    /* INC 8 */ \
+    OP(0x04, 4, 4, cpu->b = op_inc_8(cpu, cpu->b)) \
+    OP(0x14, 4, 4, cpu->d = op_inc_8(cpu, cpu->d)) \
+    OP(0x24, 4, 4, cpu->h = op_inc_8(cpu, cpu->h)) \
+    OP(0x34, 12, 12, BusWrite(bus, cpu->hl, op_inc_8(cpu, BusRead(bus, cpu->hl)))) \
+    OP(0x0C, 4, 4, cpu->c = op_inc_8(cpu, cpu->c)) \
+    OP(0x1C, 4, 4, cpu->e = op_inc_8(cpu, cpu->e)) \
+    OP(0x2C, 4, 4, cpu->l = op_inc_8(cpu, cpu->l)) \
+    OP(0x3C, 4, 4, cpu->a = op_inc_8(cpu, cpu->a)) \
+ \
+    /* INC 16 */ \
+    OP(0x03, 8, 8, cpu->bc = op_inc_16(cpu, cpu->bc)) \
+    OP(0x13, 8, 8, cpu->de = op_inc_16(cpu, cpu->de)) \
+    OP(0x23, 8, 8, cpu->hl = op_inc_16(cpu, cpu->hl)) \
+    OP(0x33, 8, 8, cpu->sp = op_inc_16(cpu, cpu->sp)) \
+ \
+    /* DEC 8 */ \
+    OP(0x05, 4, 4, cpu->b = op_dec_8(cpu, cpu->b)) \
+    OP(0x15, 4, 4, cpu->d = op_dec_8(cpu, cpu->d)) \
+    OP(0x25, 4, 4, cpu->h = op_dec_8(cpu, cpu->h)) \
+    OP(0x35, 12, 12, BusWrite(bus, cpu->hl, op_dec_8(cpu, BusRead(bus, cpu->hl)))) \
+    OP(0x0D, 4, 4, cpu->c = op_dec_8(cpu, cpu->c)) \
+    OP(0x1D, 4, 4, cpu->e = op_dec_8(cpu, cpu->e)) \
+    OP(0x2D, 4, 4, cpu->l = op_dec_8(cpu, cpu->l)) \
+    OP(0x3D, 4, 4, cpu->a = op_dec_8(cpu, cpu->a)) \
+ \
+    /* DEC 16 */ \
+    OP(0x0B, 8, 8, cpu->bc = op_dec_16(cpu, cpu->bc)) \
+    OP(0x1B, 8, 8, cpu->de = op_dec_16(cpu, cpu->de)) \
+    OP(0x2B, 8, 8, cpu->hl = op_dec_16(cpu, cpu->hl)) \
+    OP(0x3B, 8, 8, cpu->sp = op_dec_16(cpu, cpu->sp)) \
+ \
+    /* JR */ \
+    OP(0x18, 12, 12, JR_LOOP) \
+    OP(0x20, 8, 12, JR_IF(!flagGet(cpu, FLAG_Z))) \
+    OP(0x28, 8, 12, JR_IF(flagGet(cpu, FLAG_Z))) \
+    OP(0x30, 8, 12, JR_IF(!flagGet(cpu, FLAG_C))) \
+    OP(0x38, 8, 12, JR_IF(flagGet(cpu, FLAG_C))) \
+ \
+    /* JP */ \
+    OP(0xC2, 12, 16, JP_IF(!flagGet(cpu, FLAG_Z))) \
+    OP(0xD2, 12, 16, JP_IF(!flagGet(cpu, FLAG_C))) \
+    OP(0xC3, 16, 16, op_jp(cpu, bus)) \
+    OP(0xCA, 12, 16, JP_IF(flagGet(cpu, FLAG_Z))) \
+    OP(0xDA, 12, 16, JP_IF(flagGet(cpu, FLAG_C))) \
+    OP(0xE9, 4, 4, cpu->pc = cpu->hl) \
+ \
+    /* LD Immediate */ \
+    OP(0x06, 8, 8, cpu->b = op_ld_immediate(cpu, bus)) \
+    OP(0x16, 8, 8, cpu->d = op_ld_immediate(cpu, bus)) \
+    OP(0x26, 8, 8, cpu->h = op_ld_immediate(cpu, bus)) \
+    OP(0x36, 12, 12, BusWrite(bus, cpu->hl, op_ld_immediate(cpu, bus))) \
+    OP(0x0E, 8, 8, cpu->c = op_ld_immediate(cpu, bus)) \
+    OP(0x1E, 8, 8, cpu->e = op_ld_immediate(cpu, bus)) \
+    OP(0x2E, 8, 8, cpu->l = op_ld_immediate(cpu, bus)) \
+    OP(0x3E, 8, 8, cpu->a = op_ld_immediate(cpu, bus)) \
+ \
+    /* LD Register to register + halt */ \
+    OP(0x40, 4, 4, cpu->b = cpu->b) \
+    OP(0x41, 4, 4, cpu->b = cpu->c) \
+    OP(0x42, 4, 4, cpu->b = cpu->d) \
+    OP(0x43, 4, 4, cpu->b = cpu->e) \
+    OP(0x44, 4, 4, cpu->b = cpu->h) \
+    OP(0x45, 4, 4, cpu->b = cpu->l) \
+    OP(0x46, 8, 8, cpu->b = BusRead(bus, cpu->hl)) \
+    OP(0x47, 4, 4, cpu->b = cpu->a) \
+    OP(0x48, 4, 4, cpu->c = cpu->b) \
+    OP(0x49, 4, 4, cpu->c = cpu->c) \
+    OP(0x4A, 4, 4, cpu->c = cpu->d) \
+    OP(0x4B, 4, 4, cpu->c = cpu->e) \
+    OP(0x4C, 4, 4, cpu->c = cpu->h) \
+    OP(0x4D, 4, 4, cpu->c = cpu->l) \
+    OP(0x4E, 8, 8, cpu->c = BusRead(bus, cpu->hl)) \
+    OP(0x4F, 4, 4, cpu->c = cpu->a) \
+ \
+    OP(0x50, 4, 4, cpu->d = cpu->b) \
+    OP(0x51, 4, 4, cpu->d = cpu->c) \
+    OP(0x52, 4, 4, cpu->d = cpu->d) \
+    OP(0x53, 4, 4, cpu->d = cpu->e) \
+    OP(0x54, 4, 4, cpu->d = cpu->h) \
+    OP(0x55, 4, 4, cpu->d = cpu->l) \
+    OP(0x56, 8, 8, cpu->d = BusRead(bus, cpu->hl)) \
+    OP(0x57, 4, 4, cpu->d = cpu->a) \
+    OP(0x58, 4, 4, cpu->e = cpu->b) \
+    OP(0x59, 4, 4, cpu->e = cpu->c) \
+    OP(0x5A, 4, 4, cpu->e = cpu->d) \
+    OP(0x5B, 4, 4, cpu->e = cpu->e) \
+    OP(0x5C, 4, 4, cpu->e = cpu->h) \
+    OP(0x5D, 4, 4, cpu->e = cpu->l) \
+    OP(0x5E, 8, 8, cpu->e = BusRead(bus, cpu->hl)) \
+    OP(0x5F, 4, 4, cpu->e = cpu->a) \
+ \
+    OP(0x60, 4, 4, cpu->h = cpu->b) \
+    OP(0x61, 4, 4, cpu->h = cpu->c) \
+    OP(0x62, 4, 4, cpu->h = cpu->d) \
+    OP(0x63, 4, 4, cpu->h = cpu->e) \
+    OP(0x64, 4, 4, cpu->h = cpu->h) \
+    OP(0x65, 4, 4, cpu->h = cpu->l) \
+    OP(0x66, 8, 8, cpu->h = BusRead(bus, cpu->hl)) \
+    OP(0x67, 4, 4, cpu->h = cpu->a) \
+    OP(0x68, 4, 4, cpu->l = cpu->b) \
+    OP(0x69, 4, 4, cpu->l = cpu->c) \
+    OP(0x6A, 4, 4, cpu->l = cpu->d) \
+    OP(0x6B, 4, 4, cpu->l = cpu->e) \
+    OP(0x6C, 4, 4, cpu->l = cpu->h) \
+    OP(0x6D, 4, 4, cpu->l = cpu->l) \
+    OP(0x6E, 8, 8, cpu->l = BusRead(bus, cpu->hl)) \
+    OP(0x6F, 4, 4, cpu->l = cpu->a) \
+ \
+    OP(0x70, 8, 8, BusWrite(bus, cpu->hl, cpu->b)) \
+    OP(0x71, 8, 8, BusWrite(bus, cpu->hl, cpu->c)) \
+    OP(0x72, 8, 8, BusWrite(bus, cpu->hl, cpu->d)) \
+    OP(0x73, 8, 8, BusWrite(bus, cpu->hl, cpu->e)) \
+    OP(0x74, 8, 8, BusWrite(bus, cpu->hl, cpu->h)) \
+    OP(0x75, 8, 8, BusWrite(bus, cpu->hl, cpu->l)) \
+    OP(0x76, 4, 4, cpu->halt = 1) \
+    OP(0x77, 8, 8, BusWrite(bus, cpu->hl, cpu->a)) \
+    OP(0x78, 4, 4, cpu->a = cpu->b) \
+    OP(0x79, 4, 4, cpu->a = cpu->c) \
+    OP(0x7A, 4, 4, cpu->a = cpu->d) \
+    OP(0x7B, 4, 4, cpu->a = cpu->e) \
+    OP(0x7C, 4, 4, cpu->a = cpu->h) \
+    OP(0x7D, 4, 4, cpu->a = cpu->l) \
+    OP(0x7E, 8, 8, cpu->a = BusRead(bus, cpu->hl)) \
+    OP(0x7F, 4, 4, cpu->a = cpu->a) \
+ \
+    /* LD High ram */ \
+    OP(0xE0, 12, 12, { \
+        uint8_t offset = BusRead(bus, cpu->pc++); \
+        BusWrite(bus, 0xFF00 + offset, cpu->a); }) \
+    OP(0xF0, 12, 12, { \
+        uint8_t offset = BusRead(bus, cpu->pc++); \
+        cpu->a = BusRead(bus, 0xFF00 + offset); }) \
+ \
+    /* LD Absolute */ \
+    OP(0xEA, 16, 16, { \
+        uint16_t address = BusRead16(bus, cpu->pc); \
+        cpu->pc += 2; \
+        BusWrite(bus, address, cpu->a); }) \
+    OP(0xFA, 16, 16, { \
+        uint16_t address = BusRead16(bus, cpu->pc); \
+        cpu->pc += 2; \
+        cpu->a = BusRead(bus, address); }) \
+ \
+    /* LD C offset */ \
+    OP(0xE2, 8, 8, BusWrite(bus, 0xFF00 + cpu->c, cpu->a)) \
+    OP(0xF2, 8, 8, cpu->a = BusRead(bus, 0xFF00 + cpu->c)) \
+ \
+    /* LD accumulator loads */ \
+    OP(0x02, 8, 8, BusWrite(bus, cpu->bc, cpu->a)) \
+    OP(0x12, 8, 8, BusWrite(bus, cpu->de, cpu->a)) \
+    OP(0x22, 8, 8, BusWrite(bus, cpu->hl++, cpu->a)) \
+    OP(0x32, 8, 8, BusWrite(bus, cpu->hl--, cpu->a)) \
+    OP(0x0A, 8, 8, cpu->a = BusRead(bus, cpu->bc)) \
+    OP(0x1A, 8, 8, cpu->a = BusRead(bus, cpu->de)) \
+    OP(0x2A, 8, 8, cpu->a = BusRead(bus, cpu->hl++)) \
+    OP(0x3A, 8, 8, cpu->a = BusRead(bus, cpu->hl--)) \
+ \
+    /* LD Immediate 16 */ \
+    OP(0x01, 12, 12, cpu->bc = BusRead16(bus, cpu->pc); cpu->pc += 2) \
+    OP(0x11, 12, 12, cpu->de = BusRead16(bus, cpu->pc); cpu->pc += 2) \
+    OP(0x21, 12, 12, cpu->hl = BusRead16(bus, cpu->pc); cpu->pc += 2) \
+    OP(0x31, 12, 12, cpu->sp = BusRead16(bus, cpu->pc); cpu->pc += 2) \
+ \
+    /* LD stack pointer */ \
+    OP(0x08, 20, 20, { \
+        uint16_t address = BusRead16(bus, cpu->pc); \
+        cpu->pc += 2; \
+        BusWrite(bus, address, cpu->sp & 0xFF); \
+        BusWrite(bus, address + 1, (cpu->sp >> 8) & 0xFF); }) \
+    OP(0xF8, 12, 12, { \
+        int8_t offset = (int8_t)BusRead(bus, cpu->pc++); \
+        bool h = ((cpu->sp & 0x0F) + (offset & 0x0F)) > 0xF; \
+        bool c = ((cpu->sp & 0xFF) + (offset & 0xFF)) > 0xFF; \
+        cpu->hl = cpu->sp + offset; \
+        flagSet(cpu, FLAG_Z, 0); \
+        flagSet(cpu, FLAG_N, 0); \
+        flagSet(cpu, FLAG_H, h); \
+        flagSet(cpu, FLAG_C, c); }) \
+    OP(0xF9, 8, 8, cpu->sp = cpu->hl) \
+ \
+    /* ADD */ \
+    OP(0x80, 4, 4, cpu->a = op_add(cpu, cpu->a, cpu->b, false)) \
+    OP(0x81, 4, 4, cpu->a = op_add(cpu, cpu->a, cpu->c, false)) \
+    OP(0x82, 4, 4, cpu->a = op_add(cpu, cpu->a, cpu->d, false)) \
+    OP(0x83, 4, 4, cpu->a = op_add(cpu, cpu->a, cpu->e, false)) \
+    OP(0x84, 4, 4, cpu->a = op_add(cpu, cpu->a, cpu->h, false)) \
+    OP(0x85, 4, 4, cpu->a = op_add(cpu, cpu->a, cpu->l, false)) \
+    OP(0x86, 8, 8, cpu->a = op_add(cpu, cpu->a, BusRead(bus, cpu->hl), false)) \
+    OP(0x87, 4, 4, cpu->a = op_add(cpu, cpu->a, cpu->a, false)) \
+    OP(0xC6, 8, 8, cpu->a = op_add(cpu, cpu->a, BusRead(bus, cpu->pc++), false)) \
+ \
+    /* ADC */ \
+    OP(0x88, 4, 4, cpu->a = op_add(cpu, cpu->a, cpu->b, true)) \
+    OP(0x89, 4, 4, cpu->a = op_add(cpu, cpu->a, cpu->c, true)) \
+    OP(0x8A, 4, 4, cpu->a = op_add(cpu, cpu->a, cpu->d, true)) \
+    OP(0x8B, 4, 4, cpu->a = op_add(cpu, cpu->a, cpu->e, true)) \
+    OP(0x8C, 4, 4, cpu->a = op_add(cpu, cpu->a, cpu->h, true)) \
+    OP(0x8D, 4, 4, cpu->a = op_add(cpu, cpu->a, cpu->l, true)) \
+    OP(0x8E, 8, 8, cpu->a = op_add(cpu, cpu->a, BusRead(bus, cpu->hl), true)) \
+    OP(0x8F, 4, 4, cpu->a = op_add(cpu, cpu->a, cpu->a, true)) \
+    OP(0xCE, 8, 8, cpu->a = op_add(cpu, cpu->a, BusRead(bus, cpu->pc++), true)) \
+ \
+    /* SUB */ \
+    OP(0x90, 4, 4, cpu->a = op_sub(cpu, cpu->a, cpu->b, false)) \
+    OP(0x91, 4, 4, cpu->a = op_sub(cpu, cpu->a, cpu->c, false)) \
+    OP(0x92, 4, 4, cpu->a = op_sub(cpu, cpu->a, cpu->d, false)) \
+    OP(0x93, 4, 4, cpu->a = op_sub(cpu, cpu->a, cpu->e, false)) \
+    OP(0x94, 4, 4, cpu->a = op_sub(cpu, cpu->a, cpu->h, false)) \
+    OP(0x95, 4, 4, cpu->a = op_sub(cpu, cpu->a, cpu->l, false)) \
+    OP(0x96, 8, 8, cpu->a = op_sub(cpu, cpu->a, BusRead(bus, cpu->hl), false)) \
+    OP(0x97, 4, 4, cpu->a = op_sub(cpu, cpu->a, cpu->a, false)) \
+    OP(0xD6, 8, 8, cpu->a = op_sub(cpu, cpu->a, BusRead(bus, cpu->pc++), false)) \
+ \
+    /* SBC */ \
+    OP(0x98, 4, 4, cpu->a = op_sub(cpu, cpu->a, cpu->b, true)) \
+    OP(0x99, 4, 4, cpu->a = op_sub(cpu, cpu->a, cpu->c, true)) \
+    OP(0x9A, 4, 4, cpu->a = op_sub(cpu, cpu->a, cpu->d, true)) \
+    OP(0x9B, 4, 4, cpu->a = op_sub(cpu, cpu->a, cpu->e, true)) \
+    OP(0x9C, 4, 4, cpu->a = op_sub(cpu, cpu->a, cpu->h, true)) \
+    OP(0x9D, 4, 4, cpu->a = op_sub(cpu, cpu->a, cpu->l, true)) \
+    OP(0x9E, 8, 8, cpu->a = op_sub(cpu, cpu->a, BusRead(bus, cpu->hl), true)) \
+    OP(0x9F, 4, 4, cpu->a = op_sub(cpu, cpu->a, cpu->a, true)) \
+    OP(0xDE, 8, 8, cpu->a = op_sub(cpu, cpu->a, BusRead(bus, cpu->pc++), true)) \
+ \
+    /* CP */ \
+    OP(0xB8, 4, 4, (void)op_sub(cpu, cpu->a, cpu->b, false)) \
+    OP(0xB9, 4, 4, (void)op_sub(cpu, cpu->a, cpu->c, false)) \
+    OP(0xBA, 4, 4, (void)op_sub(cpu, cpu->a, cpu->d, false)) \
+    OP(0xBB, 4, 4, (void)op_sub(cpu, cpu->a, cpu->e, false)) \
+    OP(0xBC, 4, 4, (void)op_sub(cpu, cpu->a, cpu->h, false)) \
+    OP(0xBD, 4, 4, (void)op_sub(cpu, cpu->a, cpu->l, false)) \
+    OP(0xBE, 8, 8, (void)op_sub(cpu, cpu->a, BusRead(bus, cpu->hl), false)) \
+    OP(0xBF, 4, 4, (void)op_sub(cpu, cpu->a, cpu->a, false)) \
+    OP(0xFE, 8, 8, (void)op_sub(cpu, cpu->a, BusRead(bus, cpu->pc++), false)) \
+ \
+    /* ADD HL */ \
+    OP(0x09, 8, 8, op_add_hl(cpu, cpu->bc)) \
+    OP(0x19, 8, 8, op_add_hl(cpu, cpu->de)) \
+    OP(0x29, 8, 8, op_add_hl(cpu, cpu->hl)) \
+    OP(0x39, 8, 8, op_add_hl(cpu, cpu->sp)) \
+ \
+    /* ADD SP */ \
+    OP(0xE8, 16, 16, { \
+        int8_t offset = (int8_t)BusRead(bus, cpu->pc++); \
+        flagSet(cpu, FLAG_Z, 0); \
+        flagSet(cpu, FLAG_N, 0); \
+        flagSet(cpu, FLAG_H, (cpu->sp & 0x0F) + (offset & 0x0F) > 0x0F); \
+        flagSet(cpu, FLAG_C, (cpu->sp & 0xFF) + (offset & 0xFF) > 0xFF); \
+        cpu->sp += offset; }) \
+ \
+    /* POP */ \
+    OP(0xC1, 12, 12, cpu->c = BusRead(bus, cpu->sp++); cpu->b = BusRead(bus, cpu->sp++)) \
+    OP(0xD1, 12, 12, cpu->e = BusRead(bus, cpu->sp++); cpu->d = BusRead(bus, cpu->sp++)) \
+    OP(0xE1, 12, 12, cpu->l = BusRead(bus, cpu->sp++); cpu->h = BusRead(bus, cpu->sp++)) \
+    OP(0xF1, 12, 12, { \
+        cpu->f = BusRead(bus, cpu->sp++); \
+        cpu->a = BusRead(bus, cpu->sp++); \
+        cpu->f &= 0xF0; }) \
+ \
+    /* PUSH */ \
+    OP(0xC5, 16, 16, BusWrite(bus, --cpu->sp, cpu->b); BusWrite(bus, --cpu->sp, cpu->c)) \
+    OP(0xD5, 16, 16, BusWrite(bus, --cpu->sp, cpu->d); BusWrite(bus, --cpu->sp, cpu->e)) \
+    OP(0xE5, 16, 16, BusWrite(bus, --cpu->sp, cpu->h); BusWrite(bus, --cpu->sp, cpu->l)) \
+    OP(0xF5, 16, 16, BusWrite(bus, --cpu->sp, cpu->a); BusWrite(bus, --cpu->sp, cpu->f)) \
+ \
+    /* CALL */ \
+    OP(0xC4, 12, 24, CALL_IF(!flagGet(cpu, FLAG_Z))) \
+    OP(0xD4, 12, 24, CALL_IF(!flagGet(cpu, FLAG_C))) \
+    OP(0xCC, 12, 24, CALL_IF(flagGet(cpu, FLAG_Z))) \
+    OP(0xCD, 24, 24, op_call(cpu, bus)) \
+    OP(0xDC, 12, 24, CALL_IF(flagGet(cpu, FLAG_C))) \
+ \
+    /* RET */ \
+    OP(0xC0, 8, 20, RET_IF(!flagGet(cpu, FLAG_Z))) \
+    OP(0xD0, 8, 20, RET_IF(!flagGet(cpu, FLAG_C))) \
+    OP(0xC8, 8, 20, RET_IF(flagGet(cpu, FLAG_Z))) \
+    OP(0xC9, 16, 16, op_ret(cpu, bus)) \
+    OP(0xD8, 8, 20, RET_IF(flagGet(cpu, FLAG_C))) \
+ \
+    /* RETI */ \
+    OP(0xD9, 16, 16, op_ret(cpu, bus); cpu->ime_scheduled = 1) \
+ \
+    /* RST */ \
+    OP(0xC7, 16, 16, op_rst(cpu, bus, 0x0000)) \
+    OP(0xD7, 16, 16, op_rst(cpu, bus, 0x0010)) \
+    OP(0xE7, 16, 16, op_rst(cpu, bus, 0x0020)) \
+    OP(0xF7, 16, 16, op_rst(cpu, bus, 0x0030)) \
+    OP(0xCF, 16, 16, op_rst(cpu, bus, 0x0008)) \
+    OP(0xDF, 16, 16, op_rst(cpu, bus, 0x0018)) \
+    OP(0xEF, 16, 16, op_rst(cpu, bus, 0x0028)) \
+    OP(0xFF, 16, 16, op_rst(cpu, bus, 0x0038)) \
+ \
+    /* SYSTEM */ \
+    OP(0xF3, 4, 4, cpu->ime = 0; cpu->ime_scheduled = 0) \
+    OP(0xFB, 4, 4, cpu->ime_scheduled = 1) \
+    OP(0x10, 4, 4, cpu->pc++) \
+ \
+    /* ROTATION */ \
+    OP(0x0F, 4, 4, { /* RRCA */ \
+        uint8_t bit0 = cpu->a & 0x01; \
+        cpu->a >>= 1; \
+        cpu->a |= (bit0 << 7); \
+        flagSet(cpu, FLAG_Z, 0); \
+        flagSet(cpu, FLAG_N, 0); \
+        flagSet(cpu, FLAG_H, 0); \
+        flagSet(cpu, FLAG_C, bit0); }) \
+    OP(0x07, 4, 4, { /* RLCA */ \
+        uint8_t bit7 = (cpu->a & 0x80) >> 7; \
+        cpu->a <<= 1; \
+        cpu->a |= bit7; \
+        flagSet(cpu, FLAG_Z, 0); \
+        flagSet(cpu, FLAG_N, 0); \
+        flagSet(cpu, FLAG_H, 0); \
+        flagSet(cpu, FLAG_C, bit7); }) \
+    OP(0x17, 4, 4, { /* RLA */ \
+        uint8_t oldCarry = flagGet(cpu, FLAG_C) ? 1 : 0; \
+        uint8_t bit7 = (cpu->a & 0x80) >> 7; \
+        cpu->a = (cpu->a << 1) | oldCarry; \
+        flagSet(cpu, FLAG_Z, 0); \
+        flagSet(cpu, FLAG_N, 0); \
+        flagSet(cpu, FLAG_H, 0); \
+        flagSet(cpu, FLAG_C, bit7); }) \
+    OP(0x1F, 4, 4, { /* RRA */ \
+        uint8_t oldCarry = flagGet(cpu, FLAG_C) ? 1 : 0; \
+        uint8_t bit0 = cpu->a & 0x01; \
+        cpu->a = (cpu->a >> 1) | (oldCarry << 7); \
+        flagSet(cpu, FLAG_Z, 0); \
+        flagSet(cpu, FLAG_N, 0); \
+        flagSet(cpu, FLAG_H, 0); \
+        flagSet(cpu, FLAG_C, bit0); }) \
+ \
+    /* Acumulator manipulation */ \
+    OP(0x27, 4, 4, { /* DAA */ \
+        uint8_t corr = 0; \
+        bool setCarry = false; \
+        if (flagGet(cpu, FLAG_H) || (!flagGet(cpu, FLAG_N) && (cpu->a & 0x0F) > 9)) { \
+            corr |= 0x06; \
+        } \
+        if (flagGet(cpu, FLAG_C) || (!flagGet(cpu, FLAG_N) && cpu->a > 0x99)) { \
+            corr |= 0x60; \
+            setCarry = true; \
+        } \
+        if (flagGet(cpu, FLAG_N)) { \
+            cpu->a -= corr; \
+        } else { \
+            cpu->a += corr; \
+        } \
+        flagSet(cpu, FLAG_Z, cpu->a == 0); \
+        flagSet(cpu, FLAG_H, 0); \
+        flagSet(cpu, FLAG_C, setCarry); }) \
+    OP(0x37, 4, 4, { /* SCF */ \
+        flagSet(cpu, FLAG_N, 0); \
+        flagSet(cpu, FLAG_H, 0); \
+        flagSet(cpu, FLAG_C, 1); }) \
+    OP(0x2F, 4, 4, { /* CPL */ \
+        cpu->a = ~cpu->a; \
+        flagSet(cpu, FLAG_N, 1); \
+        flagSet(cpu, FLAG_H, 1); }) \
+    OP(0x3F, 4, 4, { /* CCF */ \
+        flagSet(cpu, FLAG_N, 0); \
+        flagSet(cpu, FLAG_H, 0); \
+        flagSet(cpu, FLAG_C, !flagGet(cpu, FLAG_C)); }) \
+ \
+    /* Unused opcodes */ \
+    OP(0xD3, 0, 0, cpu_crash(cpu, bus)) \
+    OP(0xDB, 0, 0, cpu_crash(cpu, bus)) \
+    OP(0xDD, 0, 0, cpu_crash(cpu, bus)) \
+    OP(0xE3, 0, 0, cpu_crash(cpu, bus)) \
+    OP(0xE4, 0, 0, cpu_crash(cpu, bus)) \
+    OP(0xEB, 0, 0, cpu_crash(cpu, bus)) \
+    OP(0xEC, 0, 0, cpu_crash(cpu, bus)) \
+    OP(0xED, 0, 0, cpu_crash(cpu, bus)) \
+    OP(0xF4, 0, 0, cpu_crash(cpu, bus)) \
+    OP(0xFC, 0, 0, cpu_crash(cpu, bus)) \
+    OP(0xFD, 0, 0, cpu_crash(cpu, bus))
+
+/*
+ * Prefix opcode table, one row per operation over the registers B C D E H L (HL) A
+ * CB_OP(opcode, cycles, kind, operation, bit, register)
+ */
+#define CB_ROW(CB_OP, base, kind, operation, bit, hl_cycles) \
+    CB_OP(base + 0, 8, kind, operation, bit, B) \
+    CB_OP(base + 1, 8, kind, operation, bit, C) \
+    CB_OP(base + 2, 8, kind, operation, bit, D) \
+    CB_OP(base + 3, 8, kind, operation, bit, E) \
+    CB_OP(base + 4, 8, kind, operation, bit, H) \
+    CB_OP(base + 5, 8, kind, operation, bit, L) \
+    CB_OP(base + 6, hl_cycles, kind, operation, bit, HL) \
+    CB_OP(base + 7, 8, kind, operation, bit, A)
+
+#define CB_OPCODES(CB_OP) \
+    CB_ROW(CB_OP, 0x00, SHIFT, cb_rlc, 0, 16) \
+    CB_ROW(CB_OP, 0x08, SHIFT, cb_rrc, 0, 16) \
+    CB_ROW(CB_OP, 0x10, SHIFT, cb_rl, 0, 16) \
+    CB_ROW(CB_OP, 0x18, SHIFT, cb_rr, 0, 16) \
+    CB_ROW(CB_OP, 0x20, SHIFT, cb_sla, 0, 16) \
+    CB_ROW(CB_OP, 0x28, SHIFT, cb_sra, 0, 16) \
+    CB_ROW(CB_OP, 0x30, SHIFT, cb_swap, 0, 16) \
+    CB_ROW(CB_OP, 0x38, SHIFT, cb_srl, 0, 16) \
+    CB_ROW(CB_OP, 0x40, BIT, cb_bit, 0, 12) \
+    CB_ROW(CB_OP, 0x48, BIT, cb_bit, 1, 12) \
+    CB_ROW(CB_OP, 0x50, BIT, cb_bit, 2, 12) \
+    CB_ROW(CB_OP, 0x58, BIT, cb_bit, 3, 12) \
+    CB_ROW(CB_OP, 0x60, BIT, cb_bit, 4, 12) \
+    CB_ROW(CB_OP, 0x68, BIT, cb_bit, 5, 12) \
+    CB_ROW(CB_OP, 0x70, BIT, cb_bit, 6, 12) \
+    CB_ROW(CB_OP, 0x78, BIT, cb_bit, 7, 12) \
+    CB_ROW(CB_OP, 0x80, RES, res, 0, 16) \
+    CB_ROW(CB_OP, 0x88, RES, res, 1, 16) \
+    CB_ROW(CB_OP, 0x90, RES, res, 2, 16) \
+    CB_ROW(CB_OP, 0x98, RES, res, 3, 16) \
+    CB_ROW(CB_OP, 0xA0, RES, res, 4, 16) \
+    CB_ROW(CB_OP, 0xA8, RES, res, 5, 16) \
+    CB_ROW(CB_OP, 0xB0, RES, res, 6, 16) \
+    CB_ROW(CB_OP, 0xB8, RES, res, 7, 16) \
+    CB_ROW(CB_OP, 0xC0, SET, set, 0, 16) \
+    CB_ROW(CB_OP, 0xC8, SET, set, 1, 16) \
+    CB_ROW(CB_OP, 0xD0, SET, set, 2, 16) \
+    CB_ROW(CB_OP, 0xD8, SET, set, 3, 16) \
+    CB_ROW(CB_OP, 0xE0, SET, set, 4, 16) \
+    CB_ROW(CB_OP, 0xE8, SET, set, 5, 16) \
+    CB_ROW(CB_OP, 0xF0, SET, set, 6, 16) \
+    CB_ROW(CB_OP, 0xF8, SET, set, 7, 16)
+
+// conditional flow used by the opcode bodies
+#define JR_IF(cond) if (cond) { JR_LOOP; BRANCH_TAKEN; } else { cpu->pc++; }
+#define JP_IF(cond) if (cond) { op_jp(cpu, bus); BRANCH_TAKEN; } else { cpu->pc += 2; }
+#define CALL_IF(cond) if (cond) { op_call(cpu, bus); BRANCH_TAKEN; } else { cpu->pc += 2; }
+#define RET_IF(cond) if (cond) { op_ret(cpu, bus); BRANCH_TAKEN; }
+#define BRANCH_TAKEN taken = true
+// a jump backwards may close a polling loop
+#define JR_LOOP { \
+    uint16_t from = cpu->pc - 1; \
+    op_jr(cpu, bus); \
+    if (cpu->pc < from) { idle_branch(gb_from_bus(bus), from); } \
+}
+
+// prefix operand access
+#define CB_GET_B cpu->b
+#define CB_GET_C cpu->c
+#define CB_GET_D cpu->d
+#define CB_GET_E cpu->e
+#define CB_GET_H cpu->h
+#define CB_GET_L cpu->l
+#define CB_GET_HL BusRead(bus, cpu->hl)
+#define CB_GET_A cpu->a
+#define CB_SET_B(v) cpu->b = (v)
+#define CB_SET_C(v) cpu->c = (v)
+#define CB_SET_D(v) cpu->d = (v)
+#define CB_SET_E(v) cpu->e = (v)
+#define CB_SET_H(v) cpu->h = (v)
+#define CB_SET_L(v) cpu->l = (v)
+#define CB_SET_HL(v) BusWrite(bus, cpu->hl, (v))
+#define CB_SET_A(v) cpu->a = (v)
+
+// prefix bodies, BIT only reads its operand
+#define CB_BODY_SHIFT(operation, bit, reg) CB_SET_##reg(operation(cpu, CB_GET_##reg))
+#define CB_BODY_BIT(operation, bit, reg) operation(cpu, CB_GET_##reg, bit)
+#define CB_BODY_RES(operation, bit, reg) CB_SET_##reg(CB_GET_##reg & ~(1 << bit))
+#define CB_BODY_SET(operation, bit, reg) CB_SET_##reg(CB_GET_##reg | (1 << bit))
+
+#define OP_CYCLES(code, cycles, branch_cycles, ...) [code] = cycles,
+#define OP_BRANCH_CYCLES(code, cycles, branch_cycles, ...) [code] = branch_cycles,
+#define CB_CYCLES(code, cycles, kind, operation, bit, reg) [code] = cycles,
+
+/**
+ * @brief Cycle cost of every opcode, conditional ones when the branch is not taken
+ * */
+static const uint8_t op_cycles[256] = { CPU_OPCODES(OP_CYCLES) };
+/**
+ * @brief Cycle cost of every opcode when the branch is taken
+ * */
+static const uint8_t op_branch_cycles[256] = { CPU_OPCODES(OP_BRANCH_CYCLES) };
+/**
+ * @brief Cycle cost of the prefixed opcodes, including the prefix fetch
+ * */
+static const uint8_t cb_cycles[256] = { CB_OPCODES(CB_CYCLES) };
+
+static void cpu_crash(CPU *cpu, Bus *bus) {
+    printf("Crash: opcode 0x%02X at pc 0x%04X\n", BusRead(bus, cpu->pc - 1), cpu->pc - 1);
+    exit(1);
+}
+
+#ifndef CPU_COMPUTED_GOTO
+/**
+ * @brief Opcode handler, returns true when a conditional branch was taken
+ * */
+typedef bool (*op_handler)(CPU *cpu, Bus *bus);
+typedef void (*cb_handler)(CPU *cpu, Bus *bus);
+
+#define OP_FUNCTION(code, cycles, branch_cycles, ...) \
+    static bool op_##code(CPU *cpu, Bus *bus) { bool taken = false; __VA_ARGS__; return taken; }
+#define CB_FUNCTION(code, cycles, kind, operation, bit, reg) \
+    static void cb_##operation##_##bit##_##reg(CPU *cpu, Bus *bus) { CB_BODY_##kind(operation, bit, reg); }
+#define OP_ENTRY(code, cycles, branch_cycles, ...) [code] = op_##code,
+#define CB_ENTRY(code, cycles, kind, operation, bit, reg) [code] = cb_##operation##_##bit##_##reg,
+
+CPU_OPCODES(OP_FUNCTION)
+CB_OPCODES(CB_FUNCTION)
+
+static const op_handler op_table[256] = { CPU_OPCODES(OP_ENTRY) };
+static const cb_handler cb_table[256] = { CB_OPCODES(CB_ENTRY) };
+#endif
 
 void CPUInit(CPU *cpu) { // nintendo logo skip
     cpu->a = 0x01;
@@ -32,17 +586,17 @@ int CPUStep(CPU *cpu, Bus *bus) {
     // step++;
 
 
-    uint8_t ifFlags = BusRead(bus, 0xFF0F);
-    uint8_t ieFlags = BusRead(bus, 0xFFFF);
-    uint8_t interrupts = ifFlags & ieFlags;
+    // read directly, the scheduler keeps IF current at every instruction boundary
+    uint8_t interrupts = bus->io.registers[0x0F] & bus->io.registers[0xFF];
 
     if (cpu->halt && interrupts) {
         cpu->halt = 0;
     }
 
 
+    // nothing can happen before the next event, the peripherals catch up in one go
     if (cpu->halt) {
-        return 4;
+        return sched_halt_cycles(gb_from_bus(bus));
     }
     
     if (cpu->ime && interrupts) {
@@ -69,693 +623,48 @@ int CPUStep(CPU *cpu, Bus *bus) {
         cpu->ime = 1;
         cpu->ime_scheduled = 0;
     }
+
+    // a loop that repeated unchanged runs on until something it reads can change
+    Gameboy *gb = gb_from_bus(bus);
+    if (gb->idle.armed) {
+        uint32_t skipped = idle_skip(gb);
+        if (skipped) {
+            return skipped;
+        }
+    }
     
     uint8_t opcode = BusRead(bus, cpu->pc);
-    // printf("Opcode at 0x%04X: 0x%02X\n", cpu->pc, opcode);
     cpu->pc++;
-    switch(opcode) { // opcodes
-        // NOP
-        case 0x00: return 4;
-
-        // XOR
-        case 0xA8: op_xor(cpu, cpu->b); return 4;
-        case 0xA9: op_xor(cpu, cpu->c); return 4;
-        case 0xAA: op_xor(cpu, cpu->d); return 4;
-        case 0xAB: op_xor(cpu, cpu->e); return 4;
-        case 0xAC: op_xor(cpu, cpu->h); return 4;
-        case 0xAD: op_xor(cpu, cpu->l); return 4;   
-        case 0xAE: op_xor(cpu, BusRead(bus, cpu->hl)); return 8;
-        case 0xAF: op_xor(cpu, cpu->a); return 4;
-        case 0xEE: op_xor(cpu, BusRead(bus, cpu->pc++)); return 8;
-
-        // AND
-        case 0xA0: op_and(cpu, cpu->b); return 4;
-        case 0xA1: op_and(cpu, cpu->c); return 4;
-        case 0xA2: op_and(cpu, cpu->d); return 4;
-        case 0xA3: op_and(cpu, cpu->e); return 4;
-        case 0xA4: op_and(cpu, cpu->h); return 4;
-        case 0xA5: op_and(cpu, cpu->l); return 4;
-        case 0xA6: op_and(cpu, BusRead(bus, cpu->hl)); return 8;
-        case 0xA7: op_and(cpu, cpu->a); return 4;
-        case 0xE6: op_and(cpu, BusRead(bus, cpu->pc++)); return 8;
-
-        // OR
-        case 0xB0: op_or(cpu, cpu->b); return 4;
-        case 0xB1: op_or(cpu, cpu->c); return 4;
-        case 0xB2: op_or(cpu, cpu->d); return 4;
-        case 0xB3: op_or(cpu, cpu->e); return 4;
-        case 0xB4: op_or(cpu, cpu->h); return 4;
-        case 0xB5: op_or(cpu, cpu->l); return 4;
-        case 0xB6: op_or(cpu, BusRead(bus, cpu->hl)); return 8;
-        case 0xB7: op_or(cpu, cpu->a); return 4;
-        case 0xF6: op_or(cpu, BusRead(bus, cpu->pc++)); return 8;
-
-        // INC 8
-        case 0x04: cpu->b = op_inc_8(cpu, cpu->b); return 4;
-        case 0x14: cpu->d = op_inc_8(cpu, cpu->d); return 4;
-        case 0x24: cpu->h = op_inc_8(cpu, cpu->h); return 4;
-        case 0x34: {
-            uint8_t value = BusRead(bus, cpu->hl);
-            value = op_inc_8(cpu, value);
-            BusWrite(bus, cpu->hl, value);
-            return 12; }
-        case 0x0C: cpu->c = op_inc_8(cpu, cpu->c); return 4;
-        case 0x1C: cpu->e = op_inc_8(cpu, cpu->e); return 4;
-        case 0x2C: cpu->l = op_inc_8(cpu, cpu->l); return 4;
-        case 0x3C: cpu->a = op_inc_8(cpu, cpu->a); return 4;
-
-        // INC 16
-        case 0x03: cpu->bc = op_inc_16(cpu, cpu->bc); return 8;
-        case 0x13: cpu->de = op_inc_16(cpu, cpu->de); return 8;
-        case 0x23: cpu->hl = op_inc_16(cpu, cpu->hl); return 8;
-        case 0x33: cpu->sp = op_inc_16(cpu, cpu->sp); return 8;
-
-        // DEC 8
-        case 0x05: cpu->b = op_dec_8(cpu, cpu->b); return 4;
-        case 0x15: cpu->d = op_dec_8(cpu, cpu->d); return 4;
-        case 0x25: cpu->h = op_dec_8(cpu, cpu->h); return 4;
-        case 0x35: {
-            uint8_t value = BusRead(bus, cpu->hl);
-            value = op_dec_8(cpu, value);
-            BusWrite(bus, cpu->hl, value);
-            return 12; }
-        case 0x0D: cpu->c = op_dec_8(cpu, cpu->c); return 4;
-        case 0x1D: cpu->e = op_dec_8(cpu, cpu->e); return 4;
-        case 0x2D: cpu->l = op_dec_8(cpu, cpu->l); return 4;
-        case 0x3D: cpu->a = op_dec_8(cpu, cpu->a); return 4;
-
-        // DEC 16
-        case 0x0B: cpu->bc = op_dec_16(cpu, cpu->bc); return 8;
-        case 0x1B: cpu->de = op_dec_16(cpu, cpu->de); return 8;
-        case 0x2B: cpu->hl = op_dec_16(cpu, cpu->hl); return 8;
-        case 0x3B: cpu->sp = op_dec_16(cpu, cpu->sp); return 8;
-
-        // JR
-        case 0x18: op_jr(cpu, bus); return 12;
-        case 0x20:
-            if (!(flagGet(cpu, FLAG_Z))) {
-                op_jr(cpu, bus);
-                return 12;
-            } else {
-                cpu->pc++;
-                return 8;
-            }
-        case 0x28:
-            if (flagGet(cpu, FLAG_Z)) {
-                op_jr(cpu, bus);
-                return 12;
-            } else {
-                cpu->pc++;
-                return 8;
-            }
-        case 0x30:
-            if (!(flagGet(cpu, FLAG_C))) { 
-                op_jr(cpu, bus);
-                return 12;
-            } else {
-                cpu->pc++;
-                return 8;
-            }
-        case 0x38:
-            if (flagGet(cpu, FLAG_C)) {
-                op_jr(cpu, bus);
-                return 12;
-            } else {
-                cpu->pc++;
-                return 8;
-            }
-
-        // JP
-        case 0xC2:
-            if (!(flagGet(cpu, FLAG_Z))) {
-                op_jp(cpu, bus);
-                return 16;
-            } else {
-                cpu->pc += 2;
-                return 12;
-            }
-        case 0xD2:
-            if (!(flagGet(cpu, FLAG_C))) {
-                op_jp(cpu, bus);
-                return 16;
-            } else {
-                cpu->pc += 2;
-                return 12;
-            }
-        case 0xC3: op_jp(cpu, bus); return 16;
-        case 0xCA:
-            if (flagGet(cpu, FLAG_Z)) {
-                op_jp(cpu, bus);
-                return 16;
-            } else {
-                cpu->pc += 2;
-                return 12;
-            }
-        case 0xDA:
-            if (flagGet(cpu, FLAG_C)) {
-                op_jp(cpu, bus);
-                return 16;
-            } else {
-                cpu->pc += 2;
-                return 12;
-            }
-        case 0xE9: cpu->pc = cpu->hl; return 4;
-    
-        // LD Immediate
-        case 0x06: cpu->b = op_ld_immediate(cpu, bus); return 8;
-        case 0x16: cpu->d = op_ld_immediate(cpu, bus); return 8;
-        case 0x26: cpu->h = op_ld_immediate(cpu, bus); return 8;
-        case 0x36:
-            BusWrite(bus, cpu->hl, op_ld_immediate(cpu, bus));
-            return 12;
-        case 0x0E: cpu->c = op_ld_immediate(cpu, bus); return 8;
-        case 0x1E: cpu->e = op_ld_immediate(cpu, bus); return 8;
-        case 0x2E: cpu->l = op_ld_immediate(cpu, bus); return 8;
-        case 0x3E: cpu->a = op_ld_immediate(cpu, bus); return 8;
-        
-        // LD Register to register + halt
-        case 0x40: cpu->b = cpu->b; return 4;
-        case 0x41: cpu->b = cpu->c; return 4;
-        case 0x42: cpu->b = cpu->d; return 4;
-        case 0x43: cpu->b = cpu->e; return 4;
-        case 0x44: cpu->b = cpu->h; return 4;
-        case 0x45: cpu->b = cpu->l; return 4;
-        case 0x46: cpu->b = BusRead(bus, cpu->hl); return 8;
-        case 0x47: cpu->b = cpu->a; return 4;
-        case 0x48: cpu->c = cpu->b; return 4;
-        case 0x49: cpu->c = cpu->c; return 4;
-        case 0x4A: cpu->c = cpu->d; return 4;
-        case 0x4B: cpu->c = cpu->e; return 4;
-        case 0x4C: cpu->c = cpu->h; return 4;
-        case 0x4D: cpu->c = cpu->l; return 4;
-        case 0x4E: cpu->c = BusRead(bus, cpu->hl); return 8;
-        case 0x4F: cpu->c = cpu->a; return 4;
-
-        case 0x50: cpu->d = cpu->b; return 4;
-        case 0x51: cpu->d = cpu->c; return 4;
-        case 0x52: cpu->d = cpu->d; return 4;
-        case 0x53: cpu->d = cpu->e; return 4;
-        case 0x54: cpu->d = cpu->h; return 4;
-        case 0x55: cpu->d = cpu->l; return 4;
-        case 0x56: cpu->d = BusRead(bus, cpu->hl); return 8;
-        case 0x57: cpu->d = cpu->a; return 4;
-        case 0x58: cpu->e = cpu->b; return 4;
-        case 0x59: cpu->e = cpu->c; return 4;
-        case 0x5A: cpu->e = cpu->d; return 4;
-        case 0x5B: cpu->e = cpu->e; return 4;
-        case 0x5C: cpu->e = cpu->h; return 4;
-        case 0x5D: cpu->e = cpu->l; return 4;
-        case 0x5E: cpu->e = BusRead(bus, cpu->hl); return 8;
-        case 0x5F: cpu->e = cpu->a; return 4;
-
-        case 0x60: cpu->h = cpu->b; return 4;
-        case 0x61: cpu->h = cpu->c; return 4;
-        case 0x62: cpu->h = cpu->d; return 4;
-        case 0x63: cpu->h = cpu->e; return 4;
-        case 0x64: cpu->h = cpu->h; return 4;
-        case 0x65: cpu->h = cpu->l; return 4;
-        case 0x66: cpu->h = BusRead(bus, cpu->hl); return 8;
-        case 0x67: cpu->h = cpu->a; return 4;
-        case 0x68: cpu->l = cpu->b; return 4;
-        case 0x69: cpu->l = cpu->c; return 4;
-        case 0x6A: cpu->l = cpu->d; return 4;
-        case 0x6B: cpu->l = cpu->e; return 4;
-        case 0x6C: cpu->l = cpu->h; return 4;
-        case 0x6D: cpu->l = cpu->l; return 4;
-        case 0x6E: cpu->l = BusRead(bus, cpu->hl); return 8;
-        case 0x6F: cpu->l = cpu->a; return 4;
-
-        case 0x70: BusWrite(bus, cpu->hl, cpu->b); return 8;
-        case 0x71: BusWrite(bus, cpu->hl, cpu->c); return 8;
-        case 0x72: BusWrite(bus, cpu->hl, cpu->d); return 8;
-        case 0x73: BusWrite(bus, cpu->hl, cpu->e); return 8;
-        case 0x74: BusWrite(bus, cpu->hl, cpu->h); return 8;
-        case 0x75: BusWrite(bus, cpu->hl, cpu->l); return 8;
-        case 0x76: cpu->halt = 1; return 4;
-        case 0x77: BusWrite(bus, cpu->hl, cpu->a); return 8;
-        case 0x78: cpu->a = cpu->b; return 4;
-        case 0x79: cpu->a = cpu->c; return 4;
-        case 0x7A: cpu->a = cpu->d; return 4;
-        case 0x7B: cpu->a = cpu->e; return 4;
-        case 0x7C: cpu->a = cpu->h; return 4;
-        case 0x7D: cpu->a = cpu->l; return 4;
-        case 0x7E: cpu->a = BusRead(bus, cpu->hl); return 8;
-        case 0x7F: cpu->a = cpu->a; return 4;
-        
-        // LD High ram
-        case 0xE0: {
-            uint8_t offset = BusRead(bus, cpu->pc++);
-            BusWrite(bus, 0xFF00 + offset, cpu->a);
-            return 12; }
-        case 0xF0: {
-            uint8_t offset = BusRead(bus, cpu->pc++);
-            cpu->a = BusRead(bus, 0xFF00 + offset);
-            return 12; }
-
-        // LD Absolute
-        case 0xEA: {
-            uint16_t address = BusRead16(bus, cpu->pc);
-            cpu->pc += 2;
-            BusWrite(bus, address, cpu->a);
-            return 16; }
-        case 0xFA: {
-            uint16_t address = BusRead16(bus, cpu->pc);
-            cpu->pc += 2;
-            cpu->a = BusRead(bus, address);
-            return 16; }
-            
-        // LD C offset
-        case 0xE2:
-            BusWrite(bus, 0xFF00 + cpu->c, cpu->a);
-            return 8;
-        case 0xF2:
-            cpu->a = BusRead(bus, 0xFF00 + cpu->c);
-            return 8;
-        
-        // LD accumulator loads
-        case 0x02: BusWrite(bus, cpu->bc, cpu->a); return 8;
-        case 0x12: BusWrite(bus, cpu->de, cpu->a); return 8;
-        case 0x22: BusWrite(bus, cpu->hl++, cpu->a); return 8;
-        case 0x32: BusWrite(bus, cpu->hl--, cpu->a); return 8;
-        case 0x0A: cpu->a = BusRead(bus, cpu->bc); return 8;
-        case 0x1A: cpu->a = BusRead(bus, cpu->de); return 8;
-        case 0x2A: cpu->a = BusRead(bus, cpu->hl++); return 8;
-        case 0x3A: cpu->a = BusRead(bus, cpu->hl--); return 8;
-
-        // LD Immediate 16
-        case 0x01:
-            cpu->bc = BusRead16(bus, cpu->pc);
-            cpu->pc += 2;
-            return 12;
-        case 0x11:
-            cpu->de = BusRead16(bus, cpu->pc);
-            cpu->pc += 2;
-            return 12;
-        case 0x21:
-            cpu->hl = BusRead16(bus, cpu->pc);
-            cpu->pc += 2;
-            return 12;
-        case 0x31:
-            cpu->sp = BusRead16(bus, cpu->pc);
-            cpu->pc += 2;
-            return 12;
-
-        // LD stack pointer
-        case 0x08: {
-            uint16_t address = BusRead16(bus, cpu->pc);
-            cpu->pc += 2;
-            BusWrite(bus, address, cpu->sp & 0xFF);
-            BusWrite(bus, address + 1, (cpu->sp >> 8) & 0xFF);
-            return 20; }
-        case 0xF8: {
-            int8_t offset = (int8_t)BusRead(bus, cpu->pc++);
-            bool h = ((cpu->sp & 0x0F) + (offset & 0x0F)) > 0xF;
-            bool c = ((cpu->sp & 0xFF) + (offset & 0xFF)) > 0xFF;
-
-            cpu->hl = cpu->sp + offset;
-
-            flagSet(cpu, FLAG_Z, 0);
-            flagSet(cpu, FLAG_N, 0);
-            flagSet(cpu, FLAG_H, h);
-            flagSet(cpu, FLAG_C, c);
-
-            return 12; }
-        case 0xF9: cpu->sp = cpu->hl; return 8;
-        
-        // ADD
-        case 0x80: cpu->a = op_add(cpu, cpu->a, cpu->b, false); return 4;
-        case 0x81: cpu->a = op_add(cpu, cpu->a, cpu->c, false); return 4;
-        case 0x82: cpu->a = op_add(cpu, cpu->a, cpu->d, false); return 4;
-        case 0x83: cpu->a = op_add(cpu, cpu->a, cpu->e, false); return 4;
-        case 0x84: cpu->a = op_add(cpu, cpu->a, cpu->h, false); return 4;
-        case 0x85: cpu->a = op_add(cpu, cpu->a, cpu->l, false); return 4;
-        case 0x86: cpu->a = op_add(cpu, cpu->a, BusRead(bus, cpu->hl), false); return 8;
-        case 0x87: cpu->a = op_add(cpu, cpu->a, cpu->a, false); return 4;
-        case 0xC6: cpu->a = op_add(cpu, cpu->a, BusRead(bus, cpu->pc++), false); return 8;
-        
-        // ADC
-        case 0x88: cpu->a = op_add(cpu, cpu->a, cpu->b, true); return 4;
-        case 0x89: cpu->a = op_add(cpu, cpu->a, cpu->c, true); return 4;
-        case 0x8A: cpu->a = op_add(cpu, cpu->a, cpu->d, true); return 4;
-        case 0x8B: cpu->a = op_add(cpu, cpu->a, cpu->e, true); return 4;
-        case 0x8C: cpu->a = op_add(cpu, cpu->a, cpu->h, true); return 4;
-        case 0x8D: cpu->a = op_add(cpu, cpu->a, cpu->l, true); return 4;
-        case 0x8E: cpu->a = op_add(cpu, cpu->a, BusRead(bus, cpu->hl), true); return 8;
-        case 0x8F: cpu->a = op_add(cpu, cpu->a, cpu->a, true); return 4;
-        case 0xCE: cpu->a = op_add(cpu, cpu->a, BusRead(bus, cpu->pc++), true); return 8;
-        
-        // SUB
-        case 0x90: cpu->a = op_sub(cpu, cpu->a, cpu->b, false); return 4;
-        case 0x91: cpu->a = op_sub(cpu, cpu->a, cpu->c, false); return 4;
-        case 0x92: cpu->a = op_sub(cpu, cpu->a, cpu->d, false); return 4;
-        case 0x93: cpu->a = op_sub(cpu, cpu->a, cpu->e, false); return 4;
-        case 0x94: cpu->a = op_sub(cpu, cpu->a, cpu->h, false); return 4;
-        case 0x95: cpu->a = op_sub(cpu, cpu->a, cpu->l, false); return 4;
-        case 0x96: cpu->a = op_sub(cpu, cpu->a, BusRead(bus, cpu->hl), false); return 8;
-        case 0x97: cpu->a = op_sub(cpu, cpu->a, cpu->a, false); return 4;
-        case 0xD6: cpu->a = op_sub(cpu, cpu->a, BusRead(bus, cpu->pc++), false); return 8;
-
-        // SBC
-        case 0x98: cpu->a = op_sub(cpu, cpu->a, cpu->b, true); return 4;
-        case 0x99: cpu->a = op_sub(cpu, cpu->a, cpu->c, true); return 4;
-        case 0x9A: cpu->a = op_sub(cpu, cpu->a, cpu->d, true); return 4;
-        case 0x9B: cpu->a = op_sub(cpu, cpu->a, cpu->e, true); return 4;
-        case 0x9C: cpu->a = op_sub(cpu, cpu->a, cpu->h, true); return 4;
-        case 0x9D: cpu->a = op_sub(cpu, cpu->a, cpu->l, true); return 4;
-        case 0x9E: cpu->a = op_sub(cpu, cpu->a, BusRead(bus, cpu->hl), true); return 8;
-        case 0x9F: cpu->a = op_sub(cpu, cpu->a, cpu->a, true); return 4;
-        case 0xDE: cpu->a = op_sub(cpu, cpu->a, BusRead(bus, cpu->pc++), true); return 8;
-        
-        // CP
-        case 0xB8: (void)op_sub(cpu, cpu->a, cpu->b, false); return 4;
-        case 0xB9: (void)op_sub(cpu, cpu->a, cpu->c, false); return 4;
-        case 0xBA: (void)op_sub(cpu, cpu->a, cpu->d, false); return 4;
-        case 0xBB: (void)op_sub(cpu, cpu->a, cpu->e, false); return 4;
-        case 0xBC: (void)op_sub(cpu, cpu->a, cpu->h, false); return 4;
-        case 0xBD: (void)op_sub(cpu, cpu->a, cpu->l, false); return 4;
-        case 0xBE: (void)op_sub(cpu, cpu->a, BusRead(bus, cpu->hl), false); return 8;
-        case 0xBF: (void)op_sub(cpu, cpu->a, cpu->a, false); return 4;
-        case 0xFE: (void)op_sub(cpu, cpu->a, BusRead(bus, cpu->pc++), false); return 8;
-
-        // ADD HL
-        case 0x09: op_add_hl(cpu, cpu->bc); return 8;
-        case 0x19: op_add_hl(cpu, cpu->de); return 8;
-        case 0x29: op_add_hl(cpu, cpu->hl); return 8;
-        case 0x39: op_add_hl(cpu, cpu->sp); return 8;
-        
-        // ADD SP
-        case 0xE8: {
-            int8_t offset = (int8_t)BusRead(bus, cpu->pc++);
-
-            flagSet(cpu, FLAG_Z, 0);
-            flagSet(cpu, FLAG_N, 0);
-            flagSet(cpu, FLAG_H, (cpu->sp & 0x0F) + (offset & 0x0F) > 0x0F);
-            flagSet(cpu, FLAG_C, (cpu->sp & 0xFF) + (offset & 0xFF) > 0xFF);
-
-            cpu->sp += offset;
-            return 16; }
-
-        // POP
-        case 0xC1:
-            cpu->c = BusRead(bus, cpu->sp++);
-            cpu->b = BusRead(bus, cpu->sp++);
-            return 12;
-        case 0xD1:
-            cpu->e = BusRead(bus, cpu->sp++);
-            cpu->d = BusRead(bus, cpu->sp++);
-            return 12;
-        case 0xE1:
-            cpu->l = BusRead(bus, cpu->sp++);
-            cpu->h = BusRead(bus, cpu->sp++);
-            return 12;
-        case 0xF1:
-            cpu->f = BusRead(bus, cpu->sp++);
-            cpu->a = BusRead(bus, cpu->sp++);
-            cpu->f &= 0xF0;
-            return 12;
-        
-        // PUSH
-        case 0xC5:
-            BusWrite(bus, --cpu->sp, cpu->b);
-            BusWrite(bus, --cpu->sp, cpu->c);
-            return 16;
-        case 0xD5:
-            BusWrite(bus, --cpu->sp, cpu->d);
-            BusWrite(bus, --cpu->sp, cpu->e);
-            return 16;
-        case 0xE5:
-            BusWrite(bus, --cpu->sp, cpu->h);
-            BusWrite(bus, --cpu->sp, cpu->l);
-            return 16;
-        case 0xF5:
-            BusWrite(bus, --cpu->sp, cpu->a);
-            BusWrite(bus, --cpu->sp, cpu->f);
-            return 16;
-
-        // CALL
-        case 0xC4:
-            if (!flagGet(cpu, FLAG_Z)) {
-                op_call(cpu, bus);
-                return 24;
-            } else {
-                cpu->pc += 2;
-                return 12;
-            }
-        case 0xD4:
-            if (!flagGet(cpu, FLAG_C)) {
-                op_call(cpu, bus);
-                return 24;
-            } else {
-                cpu->pc += 2;
-                return 12;
-            }
-        case 0xCC:
-            if(flagGet(cpu, FLAG_Z)) {
-                op_call(cpu, bus);
-                return 24;
-            } else {
-                cpu->pc += 2;
-                return 12;
-            }
-        case 0xCD:
-            op_call(cpu, bus); return 24;
-        case 0xDC:
-            if (flagGet(cpu, FLAG_C)) {
-                op_call(cpu,bus);
-                return 24;
-            } else {
-                cpu->pc += 2;
-                return 12;
-            }
-
-        // RET
-        case 0xC0:
-            if (!flagGet(cpu, FLAG_Z)) {
-                op_ret(cpu, bus);
-                return 20;
-            } else {
-                return 8;
-            }
-        case 0xD0:
-            if (!flagGet(cpu, FLAG_C)) {
-                op_ret(cpu, bus);
-                return 20;
-            } else {
-                return 8;
-            }
-        case 0xC8:
-            if (flagGet(cpu, FLAG_Z)) {
-                op_ret(cpu, bus);
-                return 20;
-            } else {
-                return 8;
-            }
-        case 0xC9: op_ret(cpu, bus); return 16;
-        case 0xD8:
-            if (flagGet(cpu, FLAG_C)) {
-                op_ret(cpu, bus);
-                return 20;
-            } else {
-                return 8;
-            }
-
-        // RETI
-        case 0xD9: op_ret(cpu, bus); cpu->ime_scheduled = 1; return 16;
-        
-        // RST
-        case 0xC7: op_rst(cpu, bus, 0x0000); return 16;
-        case 0xD7: op_rst(cpu, bus, 0x0010); return 16;
-        case 0xE7: op_rst(cpu, bus, 0x0020); return 16;
-        case 0xF7: op_rst(cpu, bus, 0x0030); return 16;
-        case 0xCF: op_rst(cpu, bus, 0x0008); return 16;
-        case 0xDF: op_rst(cpu, bus, 0x0018); return 16;
-        case 0xEF: op_rst(cpu, bus, 0x0028); return 16;
-        case 0xFF: op_rst(cpu, bus, 0x0038); return 16;
-        
-        // SYSTEM
-        case 0xF3: cpu->ime = 0;cpu->ime_scheduled = 0; return 4;
-        case 0xFB: {
-            cpu->ime_scheduled = 1; return 4;
-        }
-        case 0x10: cpu->pc++; return 4;
-
-        // ROTATION
-        case 0x0F: { // RRCA
-            uint8_t bit0 = cpu->a & 0x01;
-
-            cpu->a >>= 1;
-            cpu->a |= (bit0 << 7);
-            flagSet(cpu, FLAG_Z, 0);
-            flagSet(cpu, FLAG_N, 0);
-            flagSet(cpu, FLAG_H, 0);
-            flagSet(cpu, FLAG_C, bit0);
-
-            return 4; }
-        case 0x07: { // RLCA
-            uint8_t bit7 = (cpu->a & 0x80) >> 7; // first place
-
-            cpu->a <<=  1;
-            cpu->a |= bit7;
-
-            flagSet(cpu, FLAG_Z, 0);
-            flagSet(cpu, FLAG_N, 0);
-            flagSet(cpu, FLAG_H, 0);
-            flagSet(cpu, FLAG_C, bit7);
-            return 4; }
-        case 0x17: { // RLA
-            uint8_t oldCarry = flagGet(cpu, FLAG_C) ? 1 : 0;
-            uint8_t bit7 = (cpu->a & 0x80) >> 7; 
-            cpu->a = (cpu->a << 1) | oldCarry;
-
-            flagSet(cpu, FLAG_Z, 0);
-            flagSet(cpu, FLAG_N, 0);
-            flagSet(cpu, FLAG_H, 0);
-            flagSet(cpu, FLAG_C, bit7);
-            return 4; }
-        case 0x1F: { // RRA
-            uint8_t oldCarry = flagGet(cpu, FLAG_C) ? 1 : 0;
-            uint8_t bit0 = cpu->a & 0x01;
-            cpu->a = (cpu->a >> 1) | (oldCarry << 7);
-
-            flagSet(cpu, FLAG_Z, 0);
-            flagSet(cpu, FLAG_N, 0);
-            flagSet(cpu, FLAG_H, 0);
-            flagSet(cpu, FLAG_C, bit0);
-            return 4;
-        }
-
-        // Acumulator manipulation
-        case 0x27: { // DAA 
-            uint8_t corr = 0;
-            bool setCarry = false;
-
-            if (flagGet(cpu, FLAG_H) || (!flagGet(cpu, FLAG_N) && (cpu->a & 0x0F) > 9)) {
-                corr |= 0x06;
-            }
-
-            if (flagGet(cpu, FLAG_C) || (!flagGet(cpu, FLAG_N) && cpu->a > 0x99)) {
-                corr |= 0x60;
-                setCarry = true;
-            }
-
-            if (flagGet(cpu, FLAG_N)) {
-                cpu->a -= corr;
-            } else {
-                cpu->a += corr;
-            }
-
-            flagSet(cpu, FLAG_Z, cpu->a == 0);
-            flagSet(cpu, FLAG_H, 0);
-            flagSet(cpu, FLAG_C, setCarry);
-
-            return 4; }
-        case 0x37: // SCF
-            flagSet(cpu, FLAG_N, 0);
-            flagSet(cpu, FLAG_H, 0);
-            flagSet(cpu, FLAG_C, 1);
-            return 4;
-        case 0x2F: // CPL
-            cpu->a = ~cpu->a;
-            flagSet(cpu, FLAG_N, 1);
-            flagSet(cpu, FLAG_H, 1);
-            return 4;
-        case 0x3F: // CCF
-            flagSet(cpu, FLAG_N, 0);
-            flagSet(cpu, FLAG_H, 0);
-            flagSet(cpu, FLAG_C, !flagGet(cpu, FLAG_C));
-            return 4;          
-        case 0xCB: { //! PREFIX
-            uint8_t cb = BusRead(bus, cpu->pc++); // 0110 0101  0000 0001 & 0000 0011
-
-            uint8_t category = (cb >> 6) & 0x03;
-            uint8_t bit  = (cb >> 3) & 0x07;
-            uint8_t reg = (cb & 0x07);
-
-            uint8_t value = get_cb_value(cpu, bus, reg);
-
-            if (category == 1) { // bit
-                if (!(value & (1 << bit))) {
-                    flagSet(cpu, FLAG_Z, 1);
-                } else {
-                    flagSet(cpu, FLAG_Z, 0);
-                }
-
-                flagSet(cpu, FLAG_N, 0);
-                flagSet(cpu, FLAG_H, 1);
-
-                return (reg == 6) ? 12 : 8;
-            }
-            else if (category == 2) { // res
-                value &= ~(1 << bit);
-            }
-            else if (category == 3) { // set
-                value |= (1 << bit);
-            }
-            else { // shift/rotate
-                uint8_t result = value;
-                uint8_t old_carry = (cpu->f & FLAG_C) ? 1 : 0;
-                uint8_t new_carry = 0;
-
-                switch (bit) {
-                    case 0: {
-                        new_carry = (value >> 7) & 1;
-                        result = (value << 1) | new_carry;
-                        break;
-                    }
-                    case 1: {
-                        new_carry = value & 1;
-                        result = (value >> 1) | (new_carry << 7);
-                        break;
-                    }
-                    case 2: {
-                        new_carry = (value >> 7) & 1;
-                        result = (value << 1) | old_carry;
-                        break;
-                    }
-                    case 3: {
-                        new_carry = value & 1;
-                        result = (value >> 1) | (old_carry << 7);
-                        break;
-                    }
-                    case 4: {
-                        new_carry = (value >> 7) & 1;
-                        result = value << 1;
-                        break;
-                    }
-                    case 5: {
-                        new_carry = value & 1;
-                        result = (value >> 1) | (value & 0x80);
-                        break;
-                    }
-                    case 6: {
-                        result = ((value & 0x0F) << 4) | ((value & 0xF0) >> 4);
-                        new_carry = 0;
-                        break;
-                    }
-                    case 7: {
-                        new_carry = value & 1;
-                        result = value >> 1;
-                        break;
-                    }
-                }
-                flagSet(cpu, FLAG_Z, (result == 0));
-                flagSet(cpu, FLAG_N, 0);
-                flagSet(cpu, FLAG_H, 0);
-                flagSet(cpu, FLAG_C, new_carry);
-
-                value = result;
-            }
-
-            set_cb_value(cpu, bus, reg, value);
-            return (reg == 6) ? 16 : 8;
-        }
-        default: {
-            printf("Crash: opcode 0x%02X at pc 0x%04X\n", opcode, cpu->pc - 1);
-            exit(1);
-        }
+    bool taken = false;
+
+#ifdef CPU_COMPUTED_GOTO
+#define OP_LABEL(code, cycles, branch_cycles, ...) [code] = &&op_##code,
+#define CB_LABEL(code, cycles, kind, operation, bit, reg) [code] = &&prefix_##operation##_##bit##_##reg,
+#define OP_CASE(code, cycles, branch_cycles, ...) \
+    op_##code: __VA_ARGS__; return taken ? op_branch_cycles[code] : op_cycles[code];
+#define CB_CASE(code, cycles, kind, operation, bit, reg) \
+    prefix_##operation##_##bit##_##reg: CB_BODY_##kind(operation, bit, reg); return cb_cycles[code];
+
+    static const void *op_labels[256] = { CPU_OPCODES(OP_LABEL) [0xCB] = &&op_prefix };
+    static const void *cb_labels[256] = { CB_OPCODES(CB_LABEL) };
+
+    goto *op_labels[opcode];
+    op_prefix: {
+        uint8_t cb = BusRead(bus, cpu->pc++);
+        goto *cb_labels[cb];
+    }
+    CPU_OPCODES(OP_CASE)
+    CB_OPCODES(CB_CASE)
+#else
+    if (opcode == 0xCB) { //! PREFIX
+        uint8_t cb = BusRead(bus, cpu->pc++);
+        cb_table[cb](cpu, bus);
+        return cb_cycles[cb];
     }
 
-    return 0;
+    taken = op_table[opcode](cpu, bus);
+    return taken ? op_branch_cycles[opcode] : op_cycles[opcode];
+#endif
 }
 
 void HandleInterrupt(CPU *cpu, Bus *bus, uint16_t handlerAddress, uint8_t interruptBit) {
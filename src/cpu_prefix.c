@@ -1,28 +1,52 @@
 #include <cpu_prefix.h>
 
-uint8_t get_cb_value(CPU *cpu, Bus *bus, uint8_t reg) {
-    switch (reg) {
-        case 0: return cpu->b;
-        case 1: return cpu->c;
-        case 2: return cpu->d;
-        case 3: return cpu->e;
-        case 4: return cpu->h;
-        case 5: return cpu->l;
-        case 6: return BusRead(bus, cpu->hl);
-        case 7: return cpu->a;
-        default: return 0;
-    }
-}
-
-void set_cb_value(CPU *cpu, Bus *bus, uint8_t reg, uint8_t value) {
-    switch (reg) {
-        case 0: cpu->b = value; break;
-        case 1: cpu->c = value; break;
-        case 2: cpu->d = value; break;
-        case 3: cpu->e = value; break;
-        case 4: cpu->h = value; break;
-        case 5: cpu->l = value; break;
-        case 6: BusWrite(bus, cpu->hl, value); break;
-        case 7: cpu->a = value; break;
-    }
-}
\ No newline at end of file
+static uint8_t cb_result(CPU *cpu, uint8_t result, uint8_t carry) {
+    flagSet(cpu, FLAG_Z, (result == 0));
+    flagSet(cpu, FLAG_N, 0);
+    flagSet(cpu, FLAG_H, 0);
+    flagSet(cpu, FLAG_C, carry);
+
+    return result;
+}
+
+uint8_t cb_rlc(CPU *cpu, uint8_t value) {
+    uint8_t carry = (value >> 7) & 1;
+    return cb_result(cpu, (value << 1) | carry, carry);
+}
+
+uint8_t cb_rrc(CPU *cpu, uint8_t value) {
+    uint8_t carry = value & 1;
+    return cb_result(cpu, (value >> 1) | (carry << 7), carry);
+}
+
+uint8_t cb_rl(CPU *cpu, uint8_t value) {
+    uint8_t old_carry = (cpu->f & FLAG_C) ? 1 : 0;
+    return cb_result(cpu, (value << 1) | old_carry, (value >> 7) & 1);
+}
+
+uint8_t cb_rr(CPU *cpu, uint8_t value) {
+    uint8_t old_carry = (cpu->f & FLAG_C) ? 1 : 0;
+    return cb_result(cpu, (value >> 1) | (old_carry << 7), value & 1);
+}
+
+uint8_t cb_sla(CPU *cpu, uint8_t value) {
+    return cb_result(cpu, value << 1, (value >> 7) & 1);
+}
+
+uint8_t cb_sra(CPU *cpu, uint8_t value) {
+    return cb_result(cpu, (value >> 1) | (value & 0x80), value & 1);
+}
+
+uint8_t cb_swap(CPU *cpu, uint8_t value) {
+    return cb_result(cpu, ((value & 0x0F) << 4) | ((value & 0xF0) >> 4), 0);
+}
+
+uint8_t cb_srl(CPU *cpu, uint8_t value) {
+    return cb_result(cpu, value >> 1, value & 1);
+}
+
+void cb_bit(CPU *cpu, uint8_t value, uint8_t bit) {
+    flagSet(cpu, FLAG_Z, !(value & (1 << bit)));
+    flagSet(cpu, FLAG_N, 0);
+    flagSet(cpu, FLAG_H, 1);
+}
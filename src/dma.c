@@ -3,45 +3,69 @@
 #include <bus.h>
 #include <ppu.h>
 #include <dma.h>
+#include <sched.h>
 
 
-typedef struct {
-    bool active;
-    uint8_t byte;
-    uint8_t value;
-    uint8_t start_delay;
-} dma_context;
+void dma_start(Gameboy *gb, uint8_t start) {
+    gb->dma.active = true;
+    gb->dma.byte = 0;
+    gb->dma.start_delay = 2;
+    gb->dma.value = start;
 
-static dma_context ctx;
+    // only pages backed by memory, OAM and IO reads go through their handlers
+    gb->dma.bulk = gb->dma.bulk_enabled && gb->bus.read_page[start];
+    gb->dma.bulk_end = gb->sched.ticks + gb->dma.start_delay + 0xA0 - 1;
+}
+
+void dma_finish_bulk(Gameboy *gb) {
+    const uint8_t *page = gb->bus.read_page[gb->dma.value];
+
+    // the cart may have unmapped the source since the start, e.g. by disabling its RAM
+    if (!page) {
+        uint8_t data[0xA0];
+        for (int i = 0; i < 0xA0; i++) {
+            data[i] = BusRead(&gb->bus, (gb->dma.value * 0x100) + i);
+        }
+        ppu_oam_load(gb, data);
+    } else {
+        ppu_oam_load(gb, page);
+    }
 
-void dma_start(uint8_t start) {
-    ctx.active = true;
-    ctx.byte = 0;
-    ctx.start_delay = 2;
-    ctx.value = start;
+    gb->dma.byte = 0xA0;
+    gb->dma.active = false;
+    gb->dma.bulk = false;
 }
-void dma_tick(Bus *bus) {
-    if (!ctx.active) {
+void dma_tick(Gameboy *gb) {
+    if (!gb->dma.active) {
         return;
     }
 
-    if (ctx.start_delay) {
-        ctx.start_delay--;
+    if (gb->dma.start_delay) {
+        gb->dma.start_delay--;
         return;
     }
 
-    ppu_oam_write(ctx.byte, BusRead(bus, ((ctx.value * 0x100) + ctx.byte)));
+    ppu_oam_write(gb, gb->dma.byte, BusRead(&gb->bus, ((gb->dma.value * 0x100) + gb->dma.byte)));
 
-    ctx.byte++;
-    ctx.active = ctx.byte < 0xA0;
+    gb->dma.byte++;
+    gb->dma.active = gb->dma.byte < 0xA0;
 
-    if (!ctx.active) {
+    if (!gb->dma.active) {
         // printf("DMA DONE\n");
         // sleep(2);
     }
 }
 
-bool dma_transfering() {
-    return ctx.active;
+bool dma_transfering(Gameboy *gb) {
+    return gb->dma.active;
+}
+
+uint32_t dma_ticks_to_event(Gameboy *gb) {
+    if (gb->dma.active && gb->dma.bulk) {
+        return gb->dma.bulk_end + 1 - gb->sched.ticks;
+    }
+
+    // the transfer reads through the bus, step it together with the cpu
+    return gb->dma.active ? 1 : 0;
 }
 
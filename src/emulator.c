@@ -0,0 +1,77 @@
+#include <setup.h>
+#include <emulator.h>
+#include <cpu.h>
+#include <bus.h>
+#include <iogm.h>
+#include <ppu.h>
+#include <sched.h>
+#include <lcd.h>
+#include <idle.h>
+
+void gb_init(Gameboy *gb) {
+    memset(gb, 0, sizeof(Gameboy));
+    gb->kernels = ppu_kernels_get();
+
+    gb->bus.internal_divider = 0;
+    CPUInit(&gb->cpu);
+    ppu_init(gb);
+    IOInit(&gb->bus.io);
+    sched_init(gb);
+    gb->idle.enabled = true;
+    BusUpdateMap(&gb->bus);
+}
+
+int gb_step(Gameboy *gb) {
+    int cycles = CPUStep(&gb->cpu, &gb->bus);
+    sched_advance(gb, cycles);
+
+    return cycles;
+}
+
+void gb_run_frame(Gameboy *gb) {
+    uint32_t prev_frame = gb->ppu.current_frame;
+
+    while (prev_frame == gb->ppu.current_frame) {
+        int cycles = CPUStep(&gb->cpu, &gb->bus);
+        sched_advance(gb, cycles);
+    }
+}
+
+void gb_set_render_mode(Gameboy *gb, ppu_render_mode mode) {
+    sched_sync(gb);
+
+    if (mode != gb->ppu.render_mode) {
+        gb->ppu.render_mode = mode;
+
+        // a line in transfer continues where the fifo is, back to the fifo the line is redrawn
+        if (mode == PPU_RENDER_SCANLINE && LCDS_MODE(gb) == MODE_XFER) {
+            pipeline_schedule_line(gb);
+        }
+    }
+
+    sched_reschedule(gb);
+}
+
+void gb_set_frame_skip(Gameboy *gb, uint32_t n) {
+    // the ppu may still be behind, the frame it is in keeps the old setting
+    sched_sync(gb);
+    gb->ppu.frame_skip = n;
+}
+
+void gb_set_dma_bulk(Gameboy *gb, bool enabled) {
+    // a transfer already running finishes the way it started
+    sched_sync(gb);
+    gb->dma.bulk_enabled = enabled;
+}
+
+void gb_set_idle_skip(Gameboy *gb, bool enabled) {
+    gb->idle.enabled = enabled;
+    idle_reset(gb);
+}
+
+void gb_free(Gameboy *gb) {
+    battery_close(gb);
+    free(gb->ppu.video_buffer);
+    gb->ppu.video_buffer = NULL;
+    mbc_free(&gb->bus.mbc);
+}
@@ -1,58 +1,59 @@
+#include <emulator.h>
 #include <gamepad.h>
 #include <setup.h>
 #include <stdint.h>
 
-typedef struct {
-    bool button_sel;
-    bool dir_sel;
-    gamepad_state controller;
-} gamepad_context;
-
-static gamepad_context ctx = {0};
-
-bool gamepad_button_sel() {
-    return ctx.button_sel;
+bool gamepad_button_sel(Gameboy *gb) {
+    return gb->gamepad.button_sel;
 }
 
-bool gamepad_dir_sel() {
-    return ctx.dir_sel;
+bool gamepad_dir_sel(Gameboy *gb) {
+    return gb->gamepad.dir_sel;
 }
 
-void gamepad_set_sel(uint8_t value) {
-    ctx.button_sel = value & 0x20;
-    ctx.dir_sel = value & 0x10;
+void gamepad_set_sel(Gameboy *gb, uint8_t value) {
+    gb->gamepad.button_sel = value & 0x20;
+    gb->gamepad.dir_sel = value & 0x10;
 }
 
-gamepad_state *gamepad_get_state() {
-    return &ctx.controller;
+gamepad_state *gamepad_get_state(Gameboy *gb) {
+    return &gb->gamepad.controller;
 }
 
-uint8_t gamepad_get_output() {
+uint8_t gamepad_get_output(Gameboy *gb) {
     uint8_t output = 0xCF;
     //mby if instead of else if
-    if (!gamepad_button_sel()) {
-	if (gamepad_get_state()->start) {
+    if (!gamepad_button_sel(gb)) {
+	if (gamepad_get_state(gb)->start) {
 	    output &= ~(1 << 3);
-	} else if (gamepad_get_state()->select) {
+	} else if (gamepad_get_state(gb)->select) {
 	    output &= ~(1 << 2);
-	} else if (gamepad_get_state()->a) {
+	} else if (gamepad_get_state(gb)->a) {
 	    output &= ~(1 << 0);
-	} else if (gamepad_get_state()->b) {
+	} else if (gamepad_get_state(gb)->b) {
 	    output &= ~(1 << 1);
 	}
     }
 
-    if (!gamepad_dir_sel()) {
-	if (gamepad_get_state()->left) {
+    if (!gamepad_dir_sel(gb)) {
+	if (gamepad_get_state(gb)->left) {
 	    output &= ~(1 << 1);
-	} else if (gamepad_get_state()->right) {
+	} else if (gamepad_get_state(gb)->right) {
 	    output &= ~(1 << 0);
-	} else if (gamepad_get_state()->up) {
+	} else if (gamepad_get_state(gb)->up) {
 	    output &= ~(1 << 2);
-	} else if (gamepad_get_state()->down) {
+	} else if (gamepad_get_state(gb)->down) {
 	    output &= ~(1 << 3);
 	}
     }
 
     return output;
 }
+
+uint8_t gamepad_read(Gameboy *gb, uint16_t address) {
+    return gamepad_get_output(gb);
+}
+
+void gamepad_write(Gameboy *gb, uint16_t address, uint8_t value) {
+    gamepad_set_sel(gb, value);
+}
@@ -0,0 +1,304 @@
+#include <setup.h>
+#include <emulator.h>
+#include <rom.h>
+#include <savestate.h>
+#include <battery.h>
+#include <time.h>
+
+#define DEFAULT_FRAMES 600
+
+typedef enum {
+    STOP_FRAMES,
+    STOP_PC,
+    STOP_MEM
+} stop_reason;
+
+static const char *stop_names[] = {"frames", "pc", "mem"};
+
+typedef struct {
+    const char *rom;
+    uint32_t frames;
+    bool until_pc;
+    uint16_t pc;
+    bool until_mem;
+    uint16_t mem_addr;
+    uint8_t mem_value;
+    const char *dump_dir;
+    uint32_t dump_every;
+    const char *screenshot;
+    const char *stats;
+    const char *load_state;
+    const char *save_state;
+    const char *battery;
+    bool scanline;
+    uint32_t frame_skip;
+    bool bulk_dma;
+    bool no_idle_skip;
+} headless_options;
+
+static void usage(const char *name) {
+    printf("usage: %s [options] rom.gb\n", name);
+    printf("  --frames N            stop after N frames (default %d)\n", DEFAULT_FRAMES);
+    printf("  --until-pc ADDR       stop when PC reaches ADDR (hex)\n");
+    printf("  --until-mem ADDR=VAL  stop when the byte at ADDR equals VAL at the end of a frame (hex)\n");
+    printf("  --dump DIR            write frames as DIR/frame_NNNNNN.ppm\n");
+    printf("  --dump-every N        only dump every Nth frame (default 1)\n");
+    printf("  --screenshot FILE     write the last frame as a PPM\n");
+    printf("  --stats FILE          write run statistics as key=value lines\n");
+    printf("  --load-state FILE     start from a save state instead of power on\n");
+    printf("  --save-state FILE     write a save state when the run stops\n");
+    printf("  --battery FILE        load battery backed cart RAM from FILE and write it back while running\n");
+    printf("  --scanline            draw whole lines instead of the dot accurate fifo\n");
+    printf("  --bulk-dma            copy OAM DMA transfers in one go when they end\n");
+    printf("  --no-idle-skip        run every iteration of polling loops instead of jumping to the next event\n");
+    printf("  --frame-skip N        draw 1 of every N frames, dumps and screenshots show the last drawn one\n");
+}
+
+static bool parse_hex(const char *text, uint32_t max, uint32_t *out) {
+    char *end;
+    unsigned long value = strtoul(text, &end, 16);
+
+    if (end == text || value > max) {
+        return false;
+    }
+    *out = value;
+    return (*end == '\0' || *end == '=');
+}
+
+static bool parse_options(headless_options *opt, int argc, char *argv[]) {
+    memset(opt, 0, sizeof(*opt));
+    opt->frames = DEFAULT_FRAMES;
+    opt->dump_every = 1;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        uint32_t parsed;
+
+        if (arg[0] != '-') {
+            opt->rom = arg;
+            continue;
+        }
+        if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+            return false;
+        }
+        if (!strcmp(arg, "--scanline")) {
+            opt->scanline = true;
+            continue;
+        }
+        if (!strcmp(arg, "--bulk-dma")) {
+            opt->bulk_dma = true;
+            continue;
+        }
+        if (!strcmp(arg, "--no-idle-skip")) {
+            opt->no_idle_skip = true;
+            continue;
+        }
+        if (!value) {
+            printf("Missing value for %s\n", arg);
+            return false;
+        }
+        i++;
+
+        if (!strcmp(arg, "--frames")) {
+            opt->frames = strtoul(value, NULL, 10);
+        } else if (!strcmp(arg, "--until-pc")) {
+            if (!parse_hex(value, 0xFFFF, &parsed)) {
+                printf("Invalid address: %s\n", value);
+                return false;
+            }
+            opt->until_pc = true;
+            opt->pc = parsed;
+        } else if (!strcmp(arg, "--until-mem")) {
+            const char *eq = strchr(value, '=');
+            if (!parse_hex(value, 0xFFFF, &parsed) || !eq) {
+                printf("Invalid condition: %s\n", value);
+                return false;
+            }
+            opt->mem_addr = parsed;
+            if (!parse_hex(eq + 1, 0xFF, &parsed)) {
+                printf("Invalid condition: %s\n", value);
+                return false;
+            }
+            opt->until_mem = true;
+            opt->mem_value = parsed;
+        } else if (!strcmp(arg, "--dump")) {
+            opt->dump_dir = value;
+        } else if (!strcmp(arg, "--dump-every")) {
+            opt->dump_every = strtoul(value, NULL, 10);
+            if (!opt->dump_every) {
+                opt->dump_every = 1;
+            }
+        } else if (!strcmp(arg, "--screenshot")) {
+            opt->screenshot = value;
+        } else if (!strcmp(arg, "--stats")) {
+            opt->stats = value;
+        } else if (!strcmp(arg, "--frame-skip")) {
+            opt->frame_skip = strtoul(value, NULL, 10);
+        } else if (!strcmp(arg, "--load-state")) {
+            opt->load_state = value;
+        } else if (!strcmp(arg, "--save-state")) {
+            opt->save_state = value;
+        } else if (!strcmp(arg, "--battery")) {
+            opt->battery = value;
+        } else {
+            printf("Unknown option: %s\n", arg);
+            return false;
+        }
+    }
+
+    if (!opt->rom) {
+        printf("No ROM given\n");
+        return false;
+    }
+    return true;
+}
+
+static bool write_ppm(Gameboy *gb, const char *filename) {
+    FILE *fpointer = fopen(filename, "wb");
+    if (!fpointer) {
+        printf("Failed to open %s\n", filename);
+        return false;
+    }
+
+    // video buffer pixels are stored as R, G, B, A bytes
+    size_t size = XRES * YRES * 3;
+    uint8_t *rgb = malloc(size);
+    const uint8_t *pixels = (const uint8_t *)gb->ppu.video_buffer;
+    for (int i = 0; i < XRES * YRES; i++) {
+        rgb[i * 3 + 0] = pixels[i * 4 + 0];
+        rgb[i * 3 + 1] = pixels[i * 4 + 1];
+        rgb[i * 3 + 2] = pixels[i * 4 + 2];
+    }
+
+    fprintf(fpointer, "P6\n%d %d\n255\n", XRES, YRES);
+    fwrite(rgb, 1, size, fpointer);
+    fclose(fpointer);
+    free(rgb);
+    return true;
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void write_stats(Gameboy *gb, const headless_options *opt, stop_reason reason,
+                        uint32_t frames, uint64_t instructions, double seconds) {
+    FILE *fpointer = fopen(opt->stats, "w");
+    if (!fpointer) {
+        printf("Failed to open %s\n", opt->stats);
+        return;
+    }
+
+    fprintf(fpointer, "rom=%s\n", opt->rom);
+    fprintf(fpointer, "stop=%s\n", stop_names[reason]);
+    fprintf(fpointer, "frames=%u\n", frames);
+    fprintf(fpointer, "instructions=%llu\n", (unsigned long long)instructions);
+    fprintf(fpointer, "cycles=%llu\n", (unsigned long long)gb->sched.cycles);
+    fprintf(fpointer, "seconds=%.6f\n", seconds);
+    fprintf(fpointer, "fps=%.2f\n", seconds > 0 ? frames / seconds : 0.0);
+    fprintf(fpointer, "pc=%04X\nsp=%04X\naf=%04X\nbc=%04X\nde=%04X\nhl=%04X\n",
+            gb->cpu.pc, gb->cpu.sp, gb->cpu.af, gb->cpu.bc, gb->cpu.de, gb->cpu.hl);
+    fprintf(fpointer, "idle_skips=%llu\n", (unsigned long long)gb->idle.skips);
+    fprintf(fpointer, "idle_skipped_cycles=%llu\n", (unsigned long long)gb->idle.skipped_cycles);
+    fprintf(fpointer, "idle_skipped_instructions=%llu\n", (unsigned long long)gb->idle.skipped_instructions);
+    // one line per loop: head address, polled address, skips, skipped cycles
+    for (uint32_t i = 0; i < gb->idle.loop_count; i++) {
+        const idle_loop_stats *loop = &gb->idle.loops[i];
+        fprintf(fpointer, "idle_loop=%04X %04X %u %llu\n", loop->head, loop->polled, loop->skips,
+                (unsigned long long)loop->cycles);
+    }
+    fclose(fpointer);
+}
+
+int main(int argc, char *argv[]) {
+    headless_options opt;
+    if (!parse_options(&opt, argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    static Gameboy gb;
+    gb_init(&gb);
+
+    if (!LoadRom(&gb.bus, opt.rom)) {
+        printf("Failed to load ROM: %s\n", opt.rom);
+        gb_free(&gb);
+        return 1;
+    }
+    if (opt.battery && !battery_open(&gb, opt.battery)) {
+        printf("No battery backed RAM on this cartridge, ignoring %s\n", opt.battery);
+    }
+    if (opt.load_state && !savestate_load_file(&gb, opt.load_state)) {
+        printf("Failed to load state: %s\n", opt.load_state);
+        gb_free(&gb);
+        return 1;
+    }
+    if (opt.scanline) {
+        gb_set_render_mode(&gb, PPU_RENDER_SCANLINE);
+    }
+    gb_set_frame_skip(&gb, opt.frame_skip);
+    gb_set_dma_bulk(&gb, opt.bulk_dma);
+    gb_set_idle_skip(&gb, !opt.no_idle_skip);
+
+    stop_reason reason = STOP_FRAMES;
+    uint32_t frames = 0;
+    uint64_t steps = 0;
+    double start = now_seconds();
+
+    while (frames < opt.frames && reason == STOP_FRAMES) {
+        uint32_t prev_frame = gb.ppu.current_frame;
+
+        while (prev_frame == gb.ppu.current_frame) {
+            gb_step(&gb);
+            steps++;
+
+            if (opt.until_pc && gb.cpu.pc == opt.pc) {
+                reason = STOP_PC;
+                break;
+            }
+        }
+        if (reason != STOP_FRAMES) {
+            break;
+        }
+        frames++;
+        battery_update(&gb);
+
+        if (opt.dump_dir && frames % opt.dump_every == 0) {
+            char filename[1024];
+            snprintf(filename, sizeof(filename), "%s/frame_%06u.ppm", opt.dump_dir, frames);
+            write_ppm(&gb, filename);
+        }
+
+        if (opt.until_mem && BusRead(&gb.bus, opt.mem_addr) == opt.mem_value) {
+            reason = STOP_MEM;
+        }
+    }
+
+    double seconds = now_seconds() - start;
+    // a skip is one step standing for every instruction of the loop iterations it jumped over
+    uint64_t instructions = steps - gb.idle.skips + gb.idle.skipped_instructions;
+
+    printf("Stopped (%s) after %u frames, %llu instructions, %.3f s\n",
+           stop_names[reason], frames, (unsigned long long)instructions, seconds);
+
+    if (opt.screenshot) {
+        write_ppm(&gb, opt.screenshot);
+    }
+    if (opt.save_state && !savestate_save_file(&gb, opt.save_state)) {
+        printf("Failed to save state: %s\n", opt.save_state);
+    }
+    if (opt.stats) {
+        write_stats(&gb, &opt, reason, frames, instructions, seconds);
+    }
+
+    gb_free(&gb);
+
+    // a condition that was asked for but never met counts as a failure
+    if ((opt.until_pc || opt.until_mem) && reason == STOP_FRAMES) {
+        return 2;
+    }
+    return 0;
+}
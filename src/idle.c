@@ -0,0 +1,236 @@
+#include <setup.h>
+#include <emulator.h>
+#include <idle.h>
+#include <sched.h>
+
+// only the peripherals change these, and only at a scheduler deadline
+static bool polled_io(uint8_t offset) {
+    return offset == 0x04 || offset == 0x0F || offset == 0x41 || offset == 0x44;
+}
+
+// WRAM and HRAM only change through the CPU, inside the loop that means an interrupt handler
+static bool polled_address(uint16_t address) {
+    if (address >= 0xFF00) {
+        return address >= 0xFF80 || polled_io(address & 0xFF);
+    }
+    return address >= 0xC000 && address < 0xE000;
+}
+
+// reads code without going through the handlers, the bytes of a loop never sit in IO
+static bool code_byte(Gameboy *gb, uint16_t address, uint8_t *value) {
+    const uint8_t *page = gb->bus.read_page[address >> 8];
+
+    if (page) {
+        *value = page[address & 0xFF];
+        return true;
+    }
+    if (address >= 0xFF80 && address < 0xFFFF) {
+        *value = gb->bus.hram[address - 0xFF80];
+        return true;
+    }
+    return false;
+}
+
+// register only instructions with their cycles, 0 for anything that writes memory or has other effects
+static uint32_t register_op_cycles(uint8_t op) {
+    // LD r,r' without (HL) and HALT
+    if (op >= 0x40 && op < 0x80) {
+        return ((op & 0x07) == 6 || (op & 0xF8) == 0x70) ? 0 : 4;
+    }
+    // ALU A,r without (HL)
+    if (op >= 0x80 && op < 0xC0) {
+        return ((op & 0x07) == 6) ? 0 : 4;
+    }
+    // INC r, DEC r without (HL)
+    if (op < 0x40 && ((op & 0x07) == 4 || (op & 0x07) == 5)) {
+        return (op == 0x34 || op == 0x35) ? 0 : 4;
+    }
+    switch (op) {
+        case 0x00: // NOP
+        case 0x07: case 0x0F: case 0x17: case 0x1F: // rotates on A
+        case 0x27: case 0x2F: case 0x37: case 0x3F: // DAA, CPL, SCF, CCF
+            return 4;
+        case 0xC6: case 0xCE: case 0xD6: case 0xDE: // ALU A,n
+        case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+// walks the body, returns the cycles of one iteration with every exit not taken or 0 if it can't be skipped
+static uint32_t loop_length(Gameboy *gb, uint16_t head, uint16_t tail) {
+    idle_context *idle = &gb->idle;
+    uint32_t length = 0;
+    uint16_t pc = head;
+    bool polls = false;
+    uint8_t op, lo, hi;
+
+    idle->polls_div = false;
+    idle->instructions = 1;
+
+    while (pc < tail) {
+        if (!code_byte(gb, pc, &op)) {
+            return 0;
+        }
+
+        idle->instructions++;
+        uint32_t cycles = register_op_cycles(op);
+        if (cycles) {
+            pc += (cycles == 8) ? 2 : 1;
+            length += cycles;
+            continue;
+        }
+
+        switch (op) {
+            case 0xCB: // prefixed ops on registers, BIT also works on (HL) but not worth it
+                if (!code_byte(gb, pc + 1, &lo) || (lo & 0x07) == 6) {
+                    return 0;
+                }
+                pc += 2;
+                length += 8;
+                break;
+            case 0xF0: // LDH A,(n)
+                if (!code_byte(gb, pc + 1, &lo) || !polled_address(0xFF00 | lo)) {
+                    return 0;
+                }
+                idle->polled = 0xFF00 | lo;
+                idle->polls_div |= lo == 0x04;
+                polls = true;
+                pc += 2;
+                length += 12;
+                break;
+            case 0xFA: // LD A,(nn)
+                if (!code_byte(gb, pc + 1, &lo) || !code_byte(gb, pc + 2, &hi) || !polled_address(lo | (hi << 8))) {
+                    return 0;
+                }
+                idle->polled = lo | (hi << 8);
+                idle->polls_div |= idle->polled == 0xFF04;
+                polls = true;
+                pc += 3;
+                length += 16;
+                break;
+            case 0x20: case 0x28: case 0x30: case 0x38: // exits, a taken one doesn't come back the same way
+                pc += 2;
+                length += 8;
+                break;
+            default:
+                return 0;
+        }
+    }
+
+    // the body has to end exactly on the jump back
+    if (pc != tail || !polls) {
+        return 0;
+    }
+    return length + 12;
+}
+
+// field by field, the struct has padding
+static bool same_registers(const CPU *a, const CPU *b) {
+    return a->af == b->af && a->bc == b->bc && a->de == b->de && a->hl == b->hl && a->sp == b->sp &&
+           a->pc == b->pc && a->ime == b->ime && a->halt == b->halt && a->ime_scheduled == b->ime_scheduled;
+}
+
+// the timer is stepped lazily, add what it is behind the CPU
+static uint16_t divider_now(Gameboy *gb) {
+    return gb->bus.internal_divider + (gb->sched.cycles - gb->sched.ticks * 4);
+}
+
+static void count_skip(idle_context *idle, uint64_t iterations) {
+    uint32_t cycles = iterations * idle->length;
+
+    idle->skips++;
+    idle->skipped_cycles += cycles;
+    idle->skipped_instructions += iterations * idle->instructions;
+
+    for (uint32_t i = 0; i < idle->loop_count; i++) {
+        idle_loop_stats *loop = &idle->loops[i];
+        if (loop->head == idle->head && loop->polled == idle->polled) {
+            loop->skips++;
+            loop->cycles += cycles;
+            return;
+        }
+    }
+    if (idle->loop_count < IDLE_LOOP_SLOTS) {
+        idle_loop_stats *loop = &idle->loops[idle->loop_count++];
+        loop->head = idle->head;
+        loop->polled = idle->polled;
+        loop->skips = 1;
+        loop->cycles = cycles;
+    }
+}
+
+void idle_branch(Gameboy *gb, uint16_t from) {
+    idle_context *idle = &gb->idle;
+    CPU *cpu = &gb->cpu;
+
+    if (!idle->enabled || from - cpu->pc > IDLE_LOOP_BYTES) {
+        return;
+    }
+
+    // the same jump again with the same registers and no event in between: nothing the loop reads changed
+    if (idle->head == cpu->pc && idle->tail == from && idle->next == gb->sched.next &&
+        same_registers(&idle->cpu, cpu)) {
+        uint32_t length = loop_length(gb, cpu->pc, from);
+
+        // an interrupt in between shows up as a longer iteration, DIV steps without an event
+        if (length && gb->sched.cycles - idle->cycles == length &&
+            (!idle->polls_div || idle->div == divider_now(gb) >> 8)) {
+            idle->armed = true;
+            idle->length = length;
+        }
+    }
+
+    idle->head = cpu->pc;
+    idle->tail = from;
+    idle->cpu = *cpu;
+    idle->cycles = gb->sched.cycles;
+    idle->next = gb->sched.next;
+    idle->div = divider_now(gb) >> 8;
+}
+
+uint32_t idle_skip(Gameboy *gb) {
+    idle_context *idle = &gb->idle;
+    uint64_t now = gb->sched.cycles;
+    uint64_t next = gb->sched.next;
+
+    idle->armed = false;
+
+    // the jump was seen before its own cycles, an event or DIV step in them changed what the loop reads
+    if (gb->cpu.pc != idle->head || next != idle->next || next == SCHED_NEVER ||
+        (idle->polls_div && idle->div != divider_now(gb) >> 8)) {
+        return 0;
+    }
+
+    // a read synced to the last tick before the deadline already sees the change
+    if (now + 4 >= next) {
+        return 0;
+    }
+    uint64_t limit = next - 4;
+
+    // DIV counts on its own between deadlines, stop before its next step
+    if (idle->polls_div) {
+        uint64_t div_step = now + 0x100 - (divider_now(gb) & 0xFF);
+        if (div_step < limit) {
+            limit = div_step;
+        }
+    }
+
+    // whole iterations only, the last one may end right on the deadline like it would when run
+    uint64_t iterations = (limit - now) / idle->length;
+    if (!iterations) {
+        return 0;
+    }
+
+    count_skip(idle, iterations);
+    return iterations * idle->length;
+}
+
+void idle_reset(Gameboy *gb) {
+    idle_context *idle = &gb->idle;
+
+    idle->armed = false;
+    idle->head = 0;
+    idle->tail = 0;
+}
@@ -5,6 +5,7 @@
 #include <dma.h>
 #include <lcd.h>
 #include <gamepad.h>
+#include <sched.h>
 
 void IOInit(IORegisters *io) {
     for (int i = 0;i < 256; i++) {
@@ -16,30 +17,45 @@ void IOInit(IORegisters *io) {
     io->registers[0xFF] = 0x00;
 }
 
-uint8_t IORead(IORegisters *io, uint8_t offset) {
-    if (offset == 0x0F) {
-        return io->registers[offset] | 0xE0;
-    } else if (offset == 0x00) {
-        return gamepad_get_output();
-    } else if (offset >= 0x40 && offset <= 0x4B) {
-        return lcd_read(0xFF00 + offset);
+// registers without an entry are plain storage the peripherals never touch: serial, sound and the unused ones
+static const IORegister io_registers[0x80] = {
+    [0x00 ... 0x7F] = {NULL, NULL, 0x00, 0xFF, false},
+    [0x00] = {gamepad_read, gamepad_write, 0x00, 0xFF, false},
+    [0x04] = {TimerReadDivider, TimerWriteDivider, 0x00, 0xFF, true},
+    [0x05 ... 0x07] = {NULL, NULL, 0x00, 0xFF, true},
+    [0x0F] = {NULL, NULL, 0xE0, 0x1F, true},
+    [0x40 ... 0x4B] = {lcd_read, lcd_write, 0x00, 0xFF, true},
+};
+
+uint8_t IORead(Gameboy *gb, uint8_t offset) {
+    const IORegister *reg = &io_registers[offset];
+    uint8_t value;
+
+    if (reg->sync) {
+        sched_sync(gb);
+    }
+    if (reg->read) {
+        value = reg->read(gb, 0xFF00 + offset);
+    } else {
+        value = gb->bus.io.registers[offset];
     }
-    
-    return io->registers[offset];
+
+    return value | reg->read_mask;
 }
 
-void IOWrite(IORegisters *io, uint8_t offset, uint8_t value) {    
-    if (offset == 0x00) {
-	gamepad_set_sel(value);
-	return;
+void IOWrite(Gameboy *gb, uint8_t offset, uint8_t value) {
+    const IORegister *reg = &io_registers[offset];
+    uint8_t *stored = &gb->bus.io.registers[offset];
+
+    if (reg->sync) {
+        sched_sync(gb);
     }
-    if (offset == 0x0F) {
-        io->registers[offset] = value & 0x1F;
-    } else if (offset == 0xFF) {
-        io->registers[offset] = value & 0x1F;
-    } else if (offset >= 0x40 && offset <= 0x4B) {
-        lcd_write(0xFF00 + offset, value);
+    if (reg->write) {
+        reg->write(gb, 0xFF00 + offset, value);
     } else {
-        io->registers[offset] = value;
+        *stored = (*stored & ~reg->write_mask) | (value & reg->write_mask);
+    }
+    if (reg->sync) {
+        sched_reschedule(gb);
     }
 }
@@ -1,49 +1,59 @@
 #include <setup.h>
+#include <emulator.h>
 #include <bus.h>
 #include <dma.h>
 #include <lcd.h>
 #include <ppu.h>
-static lcd_context ctx;
-
 // colors
 static unsigned long colors_default[4] = {0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000};
 
-void lcd_init() {
-    ctx.lcdc = 0x91;
-    ctx.scroll_x = 0;
-    ctx.scroll_y = 0;
-    ctx.ly = 0;
-    ctx.ly_compare = 0;
-    ctx.bg_palette = 0xFC;
-    ctx.obj_palette[0] = 0xFF;
-    ctx.obj_palette[1] = 0xFF;
-    ctx.win_x = 0;
-    ctx.win_y = 0;
+static void decode_lcdc(Gameboy *gb) {
+    uint8_t lcdc = gb->lcd.lcdc;
+    lcdc_state *dec = &gb->lcd.lcdc_dec;
+
+    dec->bgw_enable = BIT(lcdc, 0);
+    dec->obj_enable = BIT(lcdc, 1);
+    dec->obj_height = BIT(lcdc, 2) ? 16 : 8;
+    dec->bg_map_area = BIT(lcdc, 3) ? 0x9C00 : 0x9800;
+    dec->bgw_data_area = BIT(lcdc, 4) ? 0x8000 : 0x8800;
+    dec->win_enable = BIT(lcdc, 5);
+    dec->win_map_area = BIT(lcdc, 6) ? 0x9C00 : 0x9800;
+    dec->lcd_enable = BIT(lcdc, 7);
+}
+
+void lcd_init(Gameboy *gb) {
+    gb->lcd.lcdc = 0x91;
+    decode_lcdc(gb);
+    gb->lcd.scroll_x = 0;
+    gb->lcd.scroll_y = 0;
+    gb->lcd.ly = 0;
+    gb->lcd.ly_compare = 0;
+    gb->lcd.bg_palette = 0xFC;
+    gb->lcd.obj_palette[0] = 0xFF;
+    gb->lcd.obj_palette[1] = 0xFF;
+    gb->lcd.win_x = 0;
+    gb->lcd.win_y = 0;
     
     for (int i=0; i<4; i++) {
-        ctx.bg_colors[i] = colors_default[i];
-        ctx.sp1_colors[i] = colors_default[i];
-        ctx.sp2_colors[i] = colors_default[i];
+        gb->lcd.bg_colors[i] = colors_default[i];
+        gb->lcd.sp1_colors[i] = colors_default[i];
+        gb->lcd.sp2_colors[i] = colors_default[i];
     }
 }
 
-lcd_context *lcd_get_context() {
-    return &ctx;
-}
-
-uint8_t lcd_read(uint16_t address) {
+uint8_t lcd_read(Gameboy *gb, uint16_t address) {
     uint8_t offset = (address - 0xFF40);
-    uint8_t *p = (uint8_t *)&ctx;
+    uint8_t *p = (uint8_t *)&gb->lcd;
 
     return p[offset];
 }
 
-void update_palette(uint8_t palette_data, uint8_t pal) {
-    uint32_t *p_colors = ctx.bg_colors;
+void update_palette(Gameboy *gb, uint8_t palette_data, uint8_t pal) {
+    uint32_t *p_colors = gb->lcd.bg_colors;
 
     switch(pal) {
-        case 1: p_colors = ctx.sp1_colors; break;
-        case 2: p_colors = ctx.sp2_colors; break;
+        case 1: p_colors = gb->lcd.sp1_colors; break;
+        case 2: p_colors = gb->lcd.sp2_colors; break;
     }
 
     p_colors[0] = colors_default[palette_data & 0b11];
@@ -52,24 +62,28 @@ void update_palette(uint8_t palette_data, uint8_t pal) {
     p_colors[3] = colors_default[(palette_data >> 6) & 0b11];
 }
 
-void lcd_write(uint16_t address, uint8_t value) {
+void lcd_write(Gameboy *gb, uint16_t address, uint8_t value) {
     uint8_t offset = (address - 0xFF40);
-    uint8_t *p = (uint8_t *)&ctx;
+    uint8_t *p = (uint8_t *)&gb->lcd;
     p[offset] = value;
 
+    if (offset == 0) {
+        decode_lcdc(gb);
+    }
+
     if (offset == 6) {
         //DMA
-        dma_start(value);
+        dma_start(gb, value);
     }
 
     if (address == 0xFF47) {
-        update_palette(value, 0);
+        update_palette(gb, value, 0);
     } else if (address == 0xFF48) {
         // update_palette(value & 0b11111100, 1);
-	update_palette(value, 1);
+	update_palette(gb, value, 1);
     } else if (address == 0xFF49) {
         // update_palette(value & 0b11111100, 2);
-        update_palette(value, 2);
+        update_palette(gb, value, 2);
     }
 
 }
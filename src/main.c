@@ -8,6 +8,9 @@
 #include <dma.h>
 #include <ppu.h>
 #include <lcd.h>
+#include <sched.h>
+#include <savestate.h>
+#include <battery.h>
 
 #define RAYGUI_IMPLEMENTATION
 #include "raygui.h"
@@ -18,6 +21,14 @@
 
 #define MENU_HEIGHT 24
 
+// frames per second of the real hardware, used for the speed readout
+#define GB_FRAME_RATE 59.73
+// fast forward multiplier that runs as many frames as fit in a host frame
+#define SPEED_UNLIMITED 0
+#define SPEED_DEFAULT 4
+// frames drawn while fast forwarding without a limit until the first host frame measured how many fit
+#define FRAME_SKIP_UNLIMITED 10
+
 #if defined(_WIN32) || defined(_WIN64)
     #define PATH_SEPARATOR "\\"
 #else
@@ -26,18 +37,33 @@
 
 void print_cpu_status(Gameboy *gb) {
     printf("PC: 0x%04X | AF: 0x%02X%02X | BC: 0x%02X%02X | DE: 0x%02X%02X | HL: 0x%02X%02X | LY: %03d | Mode: %d\n",
-    gb->cpu.pc, gb->cpu.a, gb->cpu.f, gb->cpu.b, gb->cpu.c, gb->cpu.d, gb->cpu.e, gb->cpu.h, gb->cpu.l, lcd_get_context()->ly, LCDS_MODE 
+    gb->cpu.pc, gb->cpu.a, gb->cpu.f, gb->cpu.b, gb->cpu.c, gb->cpu.d, gb->cpu.e, gb->cpu.h, gb->cpu.l, gb->lcd.ly, LCDS_MODE(gb)
     );
 }
 
 
 int main(int argc, char *argv[]) {
-    Gameboy gb = {0};
-    gb.bus.current_bank = 1;
-    gb.bus.internal_divider = 0;
-    CPUInit(&gb.cpu);
-    ppu_init();
-    IOInit(&gb.bus.io);
+    static Gameboy gb;
+    gb_init(&gb);
+
+    const char *rom_arg = NULL;
+    bool fast_forward = false;
+    int speed = SPEED_DEFAULT;
+
+    for (int i = 1; i < argc; i++) {
+	if (!strcmp(argv[i], "--speed") && i + 1 < argc) {
+	    // "--speed 0" runs unlimited
+	    speed = atoi(argv[++i]);
+	    if (speed < 0) speed = SPEED_DEFAULT;
+	    fast_forward = true;
+	} else if (!strcmp(argv[i], "--scanline")) {
+	    gb_set_render_mode(&gb, PPU_RENDER_SCANLINE);
+	} else if (!strcmp(argv[i], "--bulk-dma")) {
+	    gb_set_dma_bulk(&gb, true);
+	} else {
+	    rom_arg = argv[i];
+	}
+    }
 
     //WINDOW
     int scale = 4;
@@ -46,7 +72,7 @@ int main(int argc, char *argv[]) {
     SetTargetFPS(60);
     
     Image screen_img = {
-        .data = ppu_get_context()->video_buffer,
+        .data = gb.ppu.video_buffer,
         .width = XRES,
         .height = YRES,
         .mipmaps = 1,
@@ -57,14 +83,28 @@ int main(int argc, char *argv[]) {
 
     bool rom_loaded = false;
     int active_dropdown_menu = -1;
+    char state_path[1040] = "";
+    char save_path[1040] = "";
     
-    if (argc >= 2) {
-	if (LoadRom(&gb.bus, argv[1])) {
-	    printf("Loaded ROM: %s\n", argv[1]);
+    if (rom_arg) {
+	if (LoadRom(&gb.bus, rom_arg)) {
+	    printf("Loaded ROM: %s\n", rom_arg);
+	    snprintf(state_path, sizeof(state_path), "%s.state", rom_arg);
+	    battery_path(save_path, sizeof(save_path), rom_arg);
+	    battery_open(&gb, save_path);
 	    rom_loaded = 1;
 	}
     }
 
+    // emulation speed readout, refreshed twice a second
+    uint32_t speed_frames = 0;
+    double speed_start = GetTime();
+
+    // gb_set_frame_skip syncs the scheduler, only called when the value changes
+    uint32_t frame_skip = 1;
+    uint32_t unlimited_frames = FRAME_SKIP_UNLIMITED;
+    double speed_factor = 0;
+
     GuiWindowFileDialogState fileDialogState = InitGuiWindowFileDialog(GetWorkingDirectory());
 
     while (!WindowShouldClose()) {
@@ -90,11 +130,15 @@ int main(int argc, char *argv[]) {
 
 	    if (selected_rom[0] != '\0') {
 		if (LoadRom(&gb.bus, selected_rom)) {
-		    gb.bus.current_bank = 1;
 		    gb.bus.internal_divider = 0;
 		    CPUInit(&gb.cpu);
 		    IOInit(&gb.bus.io);
+		    sched_init(&gb);
+		    BusUpdateMap(&gb.bus);
 		    rom_loaded = true;
+		    snprintf(state_path, sizeof(state_path), "%s.state", selected_rom);
+		    battery_path(save_path, sizeof(save_path), selected_rom);
+		    battery_open(&gb, save_path);
 		    printf("Loaded ROM: %s\n", selected_rom);
 		} else {
 		    printf("Failed to load ROM: %s\n", selected_rom);
@@ -107,37 +151,83 @@ int main(int argc, char *argv[]) {
 	    //input
 	    int gamepad_id = 0;	
 	    if (IsGamepadAvailable(gamepad_id)) {
-		gamepad_get_state()->up = IsKeyDown(KEY_UP) || IsGamepadButtonDown(gamepad_id, GAMEPAD_BUTTON_LEFT_FACE_UP); 
-		gamepad_get_state()->down = IsKeyDown(KEY_DOWN) || IsGamepadButtonDown(gamepad_id, GAMEPAD_BUTTON_LEFT_FACE_DOWN); 
-		gamepad_get_state()->left = IsKeyDown(KEY_LEFT) || IsGamepadButtonDown(gamepad_id, GAMEPAD_BUTTON_LEFT_FACE_LEFT);
-		gamepad_get_state()->right = IsKeyDown(KEY_RIGHT) || IsGamepadButtonDown(gamepad_id, GAMEPAD_BUTTON_LEFT_FACE_RIGHT); 
-		gamepad_get_state()->b = IsKeyDown(KEY_Z) || IsGamepadButtonDown(gamepad_id, GAMEPAD_BUTTON_RIGHT_FACE_RIGHT); 
-		gamepad_get_state()->a = IsKeyDown(KEY_X) || IsGamepadButtonDown(gamepad_id, GAMEPAD_BUTTON_RIGHT_FACE_DOWN); 
-		gamepad_get_state()->start = IsKeyDown(KEY_ENTER) || IsGamepadButtonDown(gamepad_id, GAMEPAD_BUTTON_MIDDLE_RIGHT); 
-		gamepad_get_state()->select = IsKeyDown(KEY_TAB) || IsGamepadButtonDown(gamepad_id, GAMEPAD_BUTTON_MIDDLE_LEFT);
+		gamepad_get_state(&gb)->up = IsKeyDown(KEY_UP) || IsGamepadButtonDown(gamepad_id, GAMEPAD_BUTTON_LEFT_FACE_UP); 
+		gamepad_get_state(&gb)->down = IsKeyDown(KEY_DOWN) || IsGamepadButtonDown(gamepad_id, GAMEPAD_BUTTON_LEFT_FACE_DOWN); 
+		gamepad_get_state(&gb)->left = IsKeyDown(KEY_LEFT) || IsGamepadButtonDown(gamepad_id, GAMEPAD_BUTTON_LEFT_FACE_LEFT);
+		gamepad_get_state(&gb)->right = IsKeyDown(KEY_RIGHT) || IsGamepadButtonDown(gamepad_id, GAMEPAD_BUTTON_LEFT_FACE_RIGHT); 
+		gamepad_get_state(&gb)->b = IsKeyDown(KEY_Z) || IsGamepadButtonDown(gamepad_id, GAMEPAD_BUTTON_RIGHT_FACE_RIGHT); 
+		gamepad_get_state(&gb)->a = IsKeyDown(KEY_X) || IsGamepadButtonDown(gamepad_id, GAMEPAD_BUTTON_RIGHT_FACE_DOWN); 
+		gamepad_get_state(&gb)->start = IsKeyDown(KEY_ENTER) || IsGamepadButtonDown(gamepad_id, GAMEPAD_BUTTON_MIDDLE_RIGHT); 
+		gamepad_get_state(&gb)->select = IsKeyDown(KEY_TAB) || IsGamepadButtonDown(gamepad_id, GAMEPAD_BUTTON_MIDDLE_LEFT);
+	    } else {
+		gamepad_get_state(&gb)->up = IsKeyDown(KEY_UP); 
+		gamepad_get_state(&gb)->down = IsKeyDown(KEY_DOWN); 
+		gamepad_get_state(&gb)->left = IsKeyDown(KEY_LEFT);
+		gamepad_get_state(&gb)->right = IsKeyDown(KEY_RIGHT); 
+		gamepad_get_state(&gb)->b = IsKeyDown(KEY_Z); 
+		gamepad_get_state(&gb)->a = IsKeyDown(KEY_X); 
+		gamepad_get_state(&gb)->start = IsKeyDown(KEY_ENTER); 
+		gamepad_get_state(&gb)->select = IsKeyDown(KEY_TAB);
+	    }
+
+	    // save states next to the ROM
+	    if (IsKeyPressed(KEY_F5)) {
+		if (savestate_save_file(&gb, state_path)) {
+		    printf("Saved state: %s\n", state_path);
+		} else {
+		    printf("Failed to save state: %s\n", state_path);
+		}
+	    }
+	    if (IsKeyPressed(KEY_F9)) {
+		if (savestate_load_file(&gb, state_path)) {
+		    printf("Loaded state: %s\n", state_path);
+		} else {
+		    printf("Failed to load state: %s\n", state_path);
+		}
+	    }
+
+	    if (IsKeyPressed(KEY_F)) {
+		fast_forward = !fast_forward;
+	    }
+
+	    // fast forward only draws about the frames that get shown, 1 per host frame
+	    uint32_t skip = 1;
+	    if (fast_forward) {
+		skip = (speed == SPEED_UNLIMITED) ? unlimited_frames : (uint32_t)speed;
+	    }
+	    if (skip != frame_skip) {
+		gb_set_frame_skip(&gb, skip);
+		frame_skip = skip;
+	    }
+
+	    if (!fast_forward) {
+		gb_run_frame(&gb);
+		speed_frames++;
 	    } else {
-		gamepad_get_state()->up = IsKeyDown(KEY_UP); 
-		gamepad_get_state()->down = IsKeyDown(KEY_DOWN); 
-		gamepad_get_state()->left = IsKeyDown(KEY_LEFT);
-		gamepad_get_state()->right = IsKeyDown(KEY_RIGHT); 
-		gamepad_get_state()->b = IsKeyDown(KEY_Z); 
-		gamepad_get_state()->a = IsKeyDown(KEY_X); 
-		gamepad_get_state()->start = IsKeyDown(KEY_ENTER); 
-		gamepad_get_state()->select = IsKeyDown(KEY_TAB);
-	    }
-
-	    uint32_t prev_frame = ppu_get_context()->current_frame;
-	    while (prev_frame == ppu_get_context()->current_frame) {
-		int cycles = CPUStep(&gb.cpu, &gb.bus);
-
-		for (int i = 0; i < cycles; i += 4) {
-		    dma_tick(&gb.bus);
-		    TimerStep(&gb.bus, 4);
-		    ppu_tick(&gb.bus);
+		// leave some of the host frame for drawing
+		double deadline = GetTime() + 0.8 / 60.0;
+		uint32_t frames = 0;
+		do {
+		    gb_run_frame(&gb);
+		    frames++;
+		} while (speed == SPEED_UNLIMITED ? GetTime() < deadline : frames < (uint32_t)speed);
+
+		// the next host frame draws 1 of as many as fit in this one
+		if (speed == SPEED_UNLIMITED) {
+		    unlimited_frames = frames;
+		}
+		// run on to the next drawn frame, the screen never shows one older than the last frame run
+		for (uint32_t i = 1; gb.ppu.skip_frame && i < frame_skip; i++) {
+		    gb_run_frame(&gb);
+		    frames++;
 		}
+		speed_frames += frames;
 	    }
 
-	    UpdateTexture(screen_texture, ppu_get_context()->video_buffer);
+	    battery_update(&gb);
+
+	    // only the most recently drawn frame is shown
+	    UpdateTexture(screen_texture, gb.ppu.video_buffer);
 	    print_cpu_status(&gb);
 	}
 
@@ -234,11 +324,22 @@ int main(int argc, char *argv[]) {
 
 	GuiWindowFileDialog(&fileDialogState);
 
+	double now = GetTime();
+	if (now - speed_start >= 0.5) {
+	    speed_factor = speed_frames / (now - speed_start) / GB_FRAME_RATE;
+	    speed_frames = 0;
+	    speed_start = now;
+	}
+	if (rom_loaded) {
+	    DrawText(TextFormat("%s%.1fx", fast_forward ? ">> " : "", speed_factor), GetScreenWidth() - 170, 4, 20, LIME);
+	}
+
 	DrawFPS(GetScreenWidth() - 80, 4);
 	EndDrawing();
     }
 
     UnloadTexture(screen_texture);
     CloseWindow();
+    gb_free(&gb);
     return 0;
 }
@@ -0,0 +1,389 @@
+#include <setup.h>
+#include <mbc.h>
+#include <rom.h>
+
+static const struct {
+    uint8_t code;
+    mbc_type type;
+    bool battery;
+    bool rtc;
+    bool rumble;
+} cart_types[] = {
+    {0x00, MBC_NONE, false, false, false},
+    {0x01, MBC_1, false, false, false},
+    {0x02, MBC_1, false, false, false},
+    {0x03, MBC_1, true, false, false},
+    {0x05, MBC_2, false, false, false},
+    {0x06, MBC_2, true, false, false},
+    {0x08, MBC_NONE, false, false, false},
+    {0x09, MBC_NONE, true, false, false},
+    {0x0F, MBC_3, true, true, false},
+    {0x10, MBC_3, true, true, false},
+    {0x11, MBC_3, false, false, false},
+    {0x12, MBC_3, false, false, false},
+    {0x13, MBC_3, true, false, false},
+    {0x19, MBC_5, false, false, false},
+    {0x1A, MBC_5, false, false, false},
+    {0x1B, MBC_5, true, false, false},
+    {0x1C, MBC_5, false, false, true},
+    {0x1D, MBC_5, false, false, true},
+    {0x1E, MBC_5, true, false, true},
+};
+
+static const char *mbc_names[] = {"ROM only", "MBC1", "MBC2", "MBC3", "MBC5"};
+
+// MBC2 has 512 half bytes built in, the others take the size from the header
+static uint32_t header_ram_size(mbc_context *mbc) {
+    if (mbc->type == MBC_2) {
+        return 0x200;
+    }
+    return mbc->image->header.ram_size;
+}
+
+// multicarts repeat the header logo at the start of every 256 KB game
+static bool detect_multicart(mbc_context *mbc) {
+    if (mbc->type != MBC_1 || mbc->rom_size != 0x100000) {
+        return false;
+    }
+    return !memcmp(mbc->rom + 0x104, mbc->rom + 0x10 * ROM_BANK_SIZE + 0x104, 0x30);
+}
+
+void mbc_load(mbc_context *mbc, rom_image *image) {
+    uint8_t code = image->header.cart_type;
+
+    mbc_free(mbc);
+    mbc->image = image;
+    mbc->rom = image->data;
+    mbc->rom_size = image->size;
+
+    // unknown controllers get MBC1, the only one emulated before
+    mbc->type = MBC_1;
+    for (size_t i = 0; i < sizeof(cart_types) / sizeof(cart_types[0]); i++) {
+        if (cart_types[i].code == code) {
+            mbc->type = cart_types[i].type;
+            mbc->has_battery = cart_types[i].battery;
+            mbc->has_rtc = cart_types[i].rtc;
+            mbc->has_rumble = cart_types[i].rumble;
+            break;
+        }
+    }
+    mbc->multicart = detect_multicart(mbc);
+
+    // smaller RAM is backed by a full bank so the window can always be mapped
+    mbc->ram_size = header_ram_size(mbc);
+    if (mbc->ram_size) {
+        uint32_t alloc = (mbc->ram_size < RAM_BANK_SIZE) ? RAM_BANK_SIZE : mbc->ram_size;
+        mbc->ram = calloc(1, alloc);
+    }
+
+    memset(&mbc->regs, 0, sizeof(mbc->regs));
+    mbc->regs.rom_bank = 1;
+    mbc_update(mbc);
+}
+
+void mbc_free(mbc_context *mbc) {
+    rom_image_release(mbc->image);
+    free(mbc->ram);
+    memset(mbc, 0, sizeof(*mbc));
+}
+
+static const uint8_t *rom_bank(mbc_context *mbc, uint32_t bank) {
+    return mbc->rom + (bank & (mbc->rom_size / ROM_BANK_SIZE - 1)) * ROM_BANK_SIZE;
+}
+
+static uint8_t *ram_bank(mbc_context *mbc, uint32_t bank) {
+    uint32_t banks = mbc->ram_size / RAM_BANK_SIZE;
+
+    if (!mbc->ram || mbc->type == MBC_2) {
+        return NULL;
+    }
+    // ROM only carts have no enable register
+    if (!mbc->regs.ram_enabled && mbc->type != MBC_NONE) {
+        return NULL;
+    }
+    return mbc->ram + (banks > 1 ? (bank & (banks - 1)) * RAM_BANK_SIZE : 0);
+}
+
+void mbc_update(mbc_context *mbc) {
+    mbc_registers *r = &mbc->regs;
+
+    if (!mbc->rom) {
+        mbc->rom0 = mbc->romx = mbc->ram_window = NULL;
+        return;
+    }
+
+    switch (mbc->type) {
+        case MBC_1: {
+            int shift = mbc->multicart ? 4 : 5;
+            uint32_t low = mbc->multicart ? (r->rom_bank & 0x0F) : r->rom_bank;
+            uint32_t high = r->ram_bank << shift;
+
+            // mode 1 lets the upper bits reach bank 0 and the RAM bank
+            mbc->rom0 = rom_bank(mbc, r->mode ? high : 0);
+            mbc->romx = rom_bank(mbc, high | low);
+            mbc->ram_window = ram_bank(mbc, r->mode ? r->ram_bank : 0);
+        } break;
+        case MBC_3:
+            mbc->rom0 = rom_bank(mbc, 0);
+            mbc->romx = rom_bank(mbc, r->rom_bank);
+            // 0x08-0x0C select the clock registers
+            mbc->ram_window = (r->ram_bank <= 0x03) ? ram_bank(mbc, r->ram_bank) : NULL;
+            break;
+        case MBC_5:
+            mbc->rom0 = rom_bank(mbc, 0);
+            mbc->romx = rom_bank(mbc, r->rom_bank);
+            // bit 3 drives the rumble motor
+            mbc->ram_window = ram_bank(mbc, r->ram_bank & (mbc->has_rumble ? 0x07 : 0x0F));
+            break;
+        default:
+            mbc->rom0 = rom_bank(mbc, 0);
+            mbc->romx = rom_bank(mbc, (mbc->type == MBC_2) ? r->rom_bank : 1);
+            mbc->ram_window = ram_bank(mbc, 0);
+            break;
+    }
+}
+
+#define RTC_DAY_CYCLES (86400ULL * RTC_CYCLES_PER_SECOND)
+// the day counter has 9 bits
+#define RTC_WRAP_CYCLES (512 * RTC_DAY_CYCLES)
+
+// adds the cycles run since the last update, nothing in the cpu loop touches the clock
+static void rtc_catch_up(mbc_rtc *rtc, uint64_t now) {
+    if (!rtc->halted && now > rtc->stamp) {
+        rtc->counter += now - rtc->stamp;
+    }
+    rtc->stamp = now;
+
+    if (rtc->counter >= RTC_WRAP_CYCLES) {
+        rtc->carry = true;
+        rtc->counter %= RTC_WRAP_CYCLES;
+    }
+}
+
+static void rtc_get(mbc_rtc *rtc, uint8_t *regs) {
+    uint64_t seconds = rtc->counter / RTC_CYCLES_PER_SECOND;
+    uint32_t days = seconds / 86400;
+
+    regs[0] = seconds % 60;
+    regs[1] = (seconds / 60) % 60;
+    regs[2] = (seconds / 3600) % 24;
+    regs[3] = days & 0xFF;
+    regs[4] = ((days >> 8) & 0x01) | (rtc->halted << 6) | (rtc->carry << 7);
+}
+
+// seconds past their range are folded into the next field, a seconds write restarts the second
+static void rtc_set(mbc_rtc *rtc, const uint8_t *regs, bool reset_divider) {
+    uint32_t days = regs[3] | ((regs[4] & 0x01) << 8);
+    uint64_t seconds = regs[0] + regs[1] * 60 + regs[2] * 3600 + days * 86400ULL;
+    uint64_t divider = reset_divider ? 0 : rtc->counter % RTC_CYCLES_PER_SECOND;
+
+    rtc->counter = (seconds * RTC_CYCLES_PER_SECOND + divider) % RTC_WRAP_CYCLES;
+    rtc->halted = BIT(regs[4], 6);
+    rtc->carry = BIT(regs[4], 7);
+}
+
+static void rtc_write(mbc_rtc *rtc, uint8_t reg, uint8_t value, uint64_t now) {
+    static const uint8_t masks[5] = {0x3F, 0x3F, 0x1F, 0xFF, 0xC1};
+    uint8_t regs[5];
+
+    rtc_catch_up(rtc, now);
+    rtc_get(rtc, regs);
+    regs[reg] = value & masks[reg];
+    rtc_set(rtc, regs, reg == 0);
+
+    // games read back what they wrote without latching again
+    rtc->latched[reg] = regs[reg];
+}
+
+static void rtc_latch(mbc_rtc *rtc, uint8_t value, uint64_t now) {
+    if (rtc->latch_write == 0x00 && value == 0x01) {
+        rtc_catch_up(rtc, now);
+        rtc_get(rtc, rtc->latched);
+    }
+    rtc->latch_write = value;
+}
+
+static void put_le(uint8_t *data, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        data[i] = value >> (i * 8);
+    }
+}
+
+static uint64_t get_le(const uint8_t *data, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint64_t)data[i] << (i * 8);
+    }
+    return value;
+}
+
+void mbc_rtc_save(mbc_context *mbc, uint64_t now, uint8_t *data, int64_t host_time) {
+    uint8_t regs[5];
+
+    rtc_catch_up(&mbc->rtc, now);
+    rtc_get(&mbc->rtc, regs);
+
+    // current and latched registers as 32 bit words, then the host time
+    for (int i = 0; i < 5; i++) {
+        put_le(&data[i * 4], regs[i], 4);
+        put_le(&data[20 + i * 4], mbc->rtc.latched[i], 4);
+    }
+    put_le(&data[40], host_time, 8);
+}
+
+void mbc_rtc_load(mbc_context *mbc, uint64_t now, const uint8_t *data, int64_t host_time) {
+    mbc_rtc *rtc = &mbc->rtc;
+    uint8_t regs[5];
+
+    for (int i = 0; i < 5; i++) {
+        regs[i] = get_le(&data[i * 4], 4);
+        rtc->latched[i] = get_le(&data[20 + i * 4], 4);
+    }
+    rtc_set(rtc, regs, false);
+    rtc->stamp = now;
+
+    // the cartridge battery kept the clock running while the emulator was closed
+    int64_t saved_time = get_le(&data[40], 8);
+    if (!rtc->halted && host_time > saved_time) {
+        rtc->counter += (uint64_t)(host_time - saved_time) * RTC_CYCLES_PER_SECOND;
+        rtc_catch_up(rtc, now);
+    }
+}
+
+static bool ram_enable_value(uint8_t value) {
+    return (value & 0x0F) == 0x0A;
+}
+
+bool mbc_write(mbc_context *mbc, uint16_t address, uint8_t value, uint64_t now) {
+    mbc_registers *r = &mbc->regs;
+    const uint8_t *rom0 = mbc->rom0;
+    const uint8_t *romx = mbc->romx;
+    uint8_t *ram_window = mbc->ram_window;
+
+    switch (mbc->type) {
+        case MBC_1:
+            if (address < 0x2000) {
+                r->ram_enabled = ram_enable_value(value);
+            } else if (address < 0x4000) {
+                r->rom_bank = value & 0x1F;
+                if (!r->rom_bank) r->rom_bank = 1;
+            } else if (address < 0x6000) {
+                r->ram_bank = value & 0x03;
+            } else {
+                r->mode = value & 0x01;
+            }
+            break;
+        case MBC_2:
+            if (address >= 0x4000) {
+                return false;
+            }
+            // address bit 8 tells the two registers apart
+            if (address & 0x100) {
+                r->rom_bank = value & 0x0F;
+                if (!r->rom_bank) r->rom_bank = 1;
+            } else {
+                r->ram_enabled = ram_enable_value(value);
+            }
+            break;
+        case MBC_3:
+            if (address < 0x2000) {
+                r->ram_enabled = ram_enable_value(value);
+            } else if (address < 0x4000) {
+                r->rom_bank = value & 0x7F;
+                if (!r->rom_bank) r->rom_bank = 1;
+            } else if (address < 0x6000) {
+                r->ram_bank = value;
+            } else {
+                if (mbc->has_rtc) {
+                    rtc_latch(&mbc->rtc, value, now);
+                }
+                return false;
+            }
+            break;
+        case MBC_5:
+            // bank 0 can be selected in the switchable window
+            if (address < 0x2000) {
+                r->ram_enabled = ram_enable_value(value);
+            } else if (address < 0x3000) {
+                r->rom_bank = (r->rom_bank & 0x100) | value;
+            } else if (address < 0x4000) {
+                r->rom_bank = (r->rom_bank & 0xFF) | ((value & 0x01) << 8);
+            } else if (address < 0x6000) {
+                r->ram_bank = value & 0x0F;
+            } else {
+                return false;
+            }
+            break;
+        default:
+            return false;
+    }
+
+    mbc_update(mbc);
+    return rom0 != mbc->rom0 || romx != mbc->romx || ram_window != mbc->ram_window;
+}
+
+uint8_t mbc_ram_read(mbc_context *mbc, uint16_t address) {
+    uint16_t offset = address - 0xA000;
+
+    if (mbc->ram_window) {
+        return mbc->ram_window[offset];
+    }
+    if (!mbc->regs.ram_enabled) {
+        return 0xFF;
+    }
+    if (mbc->type == MBC_2) {
+        // 512 half bytes repeated over the whole area, the upper bits are open
+        return mbc->ram[offset & 0x1FF] | 0xF0;
+    }
+    if (mbc->has_rtc && mbc->regs.ram_bank >= 0x08 && mbc->regs.ram_bank <= 0x0C) {
+        return mbc->rtc.latched[mbc->regs.ram_bank - 0x08];
+    }
+    return 0xFF;
+}
+
+// returns true if the page was clean
+static bool mark_dirty(mbc_context *mbc, uint32_t ram_offset) {
+    uint32_t page = ram_offset / MBC_DIRTY_PAGE;
+    uint64_t bit = 1ULL << (page % 64);
+
+    if (!mbc->track_dirty || (mbc->dirty[page / 64] & bit)) {
+        return false;
+    }
+    mbc->dirty[page / 64] |= bit;
+    return true;
+}
+
+bool mbc_ram_write(mbc_context *mbc, uint16_t address, uint8_t value, uint64_t now) {
+    uint16_t offset = address - 0xA000;
+
+    if (mbc->ram_window) {
+        mbc->ram_window[offset] = value;
+        return mark_dirty(mbc, mbc->ram_window + offset - mbc->ram);
+    }
+    if (!mbc->regs.ram_enabled) {
+        return false;
+    }
+    if (mbc->type == MBC_2) {
+        mbc->ram[offset & 0x1FF] = value & 0x0F;
+        mark_dirty(mbc, offset & 0x1FF);
+    } else if (mbc->has_rtc && mbc->regs.ram_bank >= 0x08 && mbc->regs.ram_bank <= 0x0C) {
+        rtc_write(&mbc->rtc, mbc->regs.ram_bank - 0x08, value, now);
+    }
+    return false;
+}
+
+bool mbc_ram_writable(mbc_context *mbc, const uint8_t *page) {
+    uint32_t index = (page - mbc->ram) / MBC_DIRTY_PAGE;
+
+    return !mbc->track_dirty || (mbc->dirty[index / 64] & (1ULL << (index % 64)));
+}
+
+void mbc_dirty_all(mbc_context *mbc) {
+    for (uint32_t page = 0; page < mbc->ram_size / MBC_DIRTY_PAGE + (mbc->ram_size % MBC_DIRTY_PAGE != 0); page++) {
+        mbc->dirty[page / 64] |= 1ULL << (page % 64);
+    }
+}
+
+const char *mbc_name(mbc_context *mbc) {
+    return mbc_names[mbc->type];
+}
@@ -4,74 +4,169 @@
 #include <ppu.h>
 #include <ppu_sm.h>
 #include <lcd.h>
+#include <tile_cache.h>
 
-static ppu_context ctx;
+// marks or clears a sprite on the lines its Y covers
+static void sprite_lines_update(Gameboy *gb, uint8_t sprite, bool present) {
+    int top = gb->ppu.oam_ram[sprite].y - 16;
+    int bottom = top + gb->ppu.sprite_lines_height;
+    uint64_t bit = 1ULL << sprite;
 
-ppu_context *ppu_get_context() {
-    return &ctx;
+    if (top < 0) top = 0;
+    if (bottom > YRES) bottom = YRES;
+
+    for (int line = top; line < bottom; line++) {
+        if (present) {
+            gb->ppu.sprite_lines[line] |= bit;
+        } else {
+            gb->ppu.sprite_lines[line] &= ~bit;
+        }
+    }
 }
 
-void ppu_oam_write(uint16_t address, uint8_t value) {
+void ppu_sprite_lines_rebuild(Gameboy *gb) {
+    memset(gb->ppu.sprite_lines, 0, sizeof(gb->ppu.sprite_lines));
+    gb->ppu.sprite_lines_height = LCDC_OBJ_HEIGHT(gb);
+
+    for (int i = 0; i < 40; i++) {
+        sprite_lines_update(gb, i, true);
+    }
+}
+
+void ppu_oam_write(Gameboy *gb, uint16_t address, uint8_t value) {
     if (address >= 0xFE00) {
         address -= 0xFE00;
     }
 
-    uint8_t *p = (uint8_t *)ctx.oam_ram;
+    uint8_t *p = (uint8_t *)gb->ppu.oam_ram;
+    uint8_t sprite = address / sizeof(oam_entry);
+    bool moved = (address % sizeof(oam_entry)) == offsetof(oam_entry, y) && p[address] != value &&
+        gb->ppu.sprite_lines_height;
+
+    if (moved) {
+        sprite_lines_update(gb, sprite, false);
+    }
     p[address] = value;
+    if (moved) {
+        sprite_lines_update(gb, sprite, true);
+    }
 }
-uint8_t ppu_oam_read(uint16_t address) {
+void ppu_oam_load(Gameboy *gb, const uint8_t *data) {
+    memcpy(gb->ppu.oam_ram, data, sizeof(gb->ppu.oam_ram));
+    gb->ppu.sprite_lines_height = 0;
+}
+
+uint8_t ppu_oam_read(Gameboy *gb, uint16_t address) {
     if (address >= 0xFE00) {
         address -= 0xFE00;
     }
 
-    uint8_t *p = (uint8_t *)ctx.oam_ram;
+    uint8_t *p = (uint8_t *)gb->ppu.oam_ram;
     return p[address];
 }
 
-void ppu_vram_write(uint16_t address, uint8_t value) {
-    ctx.vram[address - 0x8000] = value;
+void ppu_vram_write(Gameboy *gb, uint16_t address, uint8_t value) {
+    gb->ppu.vram[address - 0x8000] = value;
+    tile_cache_invalidate(gb, address);
 }
-uint8_t ppu_vram_read(uint16_t address) {
-    return ctx.vram[address - 0x8000];
+uint8_t ppu_vram_read(Gameboy *gb, uint16_t address) {
+    return gb->ppu.vram[address - 0x8000];
 }
 
-void ppu_init() {
-    ctx.current_frame = 0;
-    ctx.line_ticks = 0;
-    ctx.video_buffer = malloc(YRES * XRES * sizeof(uint32_t));
+void ppu_init(Gameboy *gb) {
+    gb->ppu.current_frame = 0;
+    gb->ppu.line_ticks = 0;
+    gb->ppu.video_buffer = malloc(YRES * XRES * sizeof(uint32_t));
 
-    ctx.pfc.line_x = 0;
-    ctx.pfc.pushed_x = 0;
-    ctx.pfc.fetch_x = 0;
-    ctx.pfc.pixel_fifo.size = 0;
-    ctx.pfc.pixel_fifo.head = 0;
-    ctx.pfc.cur_fetch_state = FS_TILE;
+    gb->ppu.pfc.line_x = 0;
+    gb->ppu.pfc.pushed_x = 0;
+    gb->ppu.pfc.fetch_x = 0;
+    gb->ppu.pfc.pixel_fifo.size = 0;
+    gb->ppu.pfc.pixel_fifo.head = 0;
+    gb->ppu.pfc.pixel_fifo.tail = 0;
+    gb->ppu.pfc.cur_fetch_state = FS_TILE;
 
-    ctx.line_sprites = 0;
-    ctx.fetched_entry_count = 0;
-    ctx.window_line = 0;
+    gb->ppu.line_sprites = 0;
+    gb->ppu.fetched_entry_count = 0;
+    gb->ppu.window_line = 0;
 
-    lcd_init();
-    LCDS_MODE_SET(MODE_OAM);
+    lcd_init(gb);
+    LCDS_MODE_SET(gb, MODE_OAM);
 
-    memset(ctx.oam_ram, 0, sizeof(ctx.oam_ram));
-    memset(ctx.video_buffer, 0, YRES * XRES * sizeof(uint32_t));
+    memset(gb->ppu.oam_ram, 0, sizeof(gb->ppu.oam_ram));
+    gb->ppu.sprite_lines_height = 0;
+    memset(gb->ppu.video_buffer, 0, YRES * XRES * sizeof(uint32_t));
 }
 
-void ppu_tick(Bus *bus) {
-    ctx.line_ticks += 1;
+bool ppu_fifo_active(Gameboy *gb) {
+    return gb->ppu.render_mode != PPU_RENDER_SCANLINE && !gb->ppu.skip_frame;
+}
+
+void ppu_tick(Gameboy *gb) {
+    gb->ppu.line_ticks += 1;
 
-    switch(LCDS_MODE) {
-        case MODE_OAM: ppu_mode_oam(); break;
-        case MODE_XFER: ppu_mode_xfer(bus); break;
-        case MODE_VBLANK: ppu_mode_vblank(bus); break;
-        case MODE_HBLANK: ppu_mode_hblank(bus); break; 
+    switch(LCDS_MODE(gb)) {
+        case MODE_OAM: ppu_mode_oam(gb); break;
+        case MODE_XFER: ppu_mode_xfer(gb); break;
+        case MODE_VBLANK: ppu_mode_vblank(gb); break;
+        case MODE_HBLANK: ppu_mode_hblank(gb); break; 
     }
 }
 
 
-void request_interrupt(Bus *bus, uint8_t interruptBit) {
-    uint8_t ifFlags = BusRead(bus, 0xFF0F);
-    ifFlags |= interruptBit;
-    BusWrite(bus, 0xFF0F, ifFlags);
+// ticks that pass without the current mode doing anything
+static uint32_t ppu_idle_ticks(Gameboy *gb) {
+    uint32_t next = gb->ppu.line_ticks + 1;
+
+    switch(LCDS_MODE(gb)) {
+        case MODE_OAM:
+            // sprites are loaded on tick 1, xfer starts at 80
+            if (next <= 1) return 1 - next;
+            return (next >= 80) ? 0 : 80 - next;
+        case MODE_HBLANK:
+        case MODE_VBLANK:
+            return (next >= TICKS_PER_LINE) ? 0 : TICKS_PER_LINE - next;
+        case MODE_XFER:
+            // the fifo works on every tick, the scanline renderer and skipped frames only at the end
+            if (ppu_fifo_active(gb)) return 0;
+            return (next >= gb->ppu.xfer_end) ? 0 : gb->ppu.xfer_end - next;
+        default:
+            return 0;
+    }
+}
+
+void ppu_run(Gameboy *gb, uint32_t ticks) {
+    while (ticks) {
+        if (LCDS_MODE(gb) == MODE_XFER && ppu_fifo_active(gb)) {
+            ppu_tick(gb);
+            ticks--;
+            continue;
+        }
+
+        uint32_t idle = ppu_idle_ticks(gb);
+        if (idle > ticks) {
+            idle = ticks;
+        }
+
+        gb->ppu.line_ticks += idle;
+        ticks -= idle;
+
+        if (ticks) {
+            ppu_tick(gb);
+            ticks--;
+        }
+    }
+}
+
+uint32_t ppu_ticks_to_event(Gameboy *gb) {
+    if (LCDS_MODE(gb) == MODE_XFER && ppu_fifo_active(gb)) {
+        return pipeline_ticks_left(gb);
+    }
+
+    return ppu_idle_ticks(gb) + 1;
+}
+
+void request_interrupt(Gameboy *gb, uint8_t interruptBit) {
+    // written directly, going through the bus would sync the scheduler from inside the ppu
+    gb->bus.io.registers[0x0F] |= interruptBit;
 }
@@ -0,0 +1,94 @@
+#include <setup.h>
+#include <ppu_kernels.h>
+#include <pthread.h>
+
+// the Makefile builds with -O2, unoptimized the intrinsics are called out of line and gain nothing
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PPU_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+#ifdef PPU_KERNELS_X86
+
+// one lane per pixel, the leftmost pixel is bit 7
+__attribute__((target("sse2")))
+static void decode_row_sse2(uint8_t lo, uint8_t hi, uint8_t *indices) {
+    const __m128i bits = _mm_setr_epi8(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+                                       0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    __m128i l = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8((char)lo), bits), bits);
+    __m128i h = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8((char)hi), bits), bits);
+    __m128i r = _mm_or_si128(_mm_and_si128(l, _mm_set1_epi8(1)), _mm_and_si128(h, _mm_set1_epi8(2)));
+
+    _mm_storel_epi64((__m128i *)indices, r);
+}
+
+// no gather or permute in sse2, every palette entry is blended in with a compare mask
+__attribute__((target("sse2")))
+static __m128i map_half_sse2(__m128i idx, const uint32_t *palette) {
+    __m128i r = _mm_and_si128(_mm_cmpeq_epi32(idx, _mm_setzero_si128()), _mm_set1_epi32(palette[0]));
+    r = _mm_or_si128(r, _mm_and_si128(_mm_cmpeq_epi32(idx, _mm_set1_epi32(1)), _mm_set1_epi32(palette[1])));
+    r = _mm_or_si128(r, _mm_and_si128(_mm_cmpeq_epi32(idx, _mm_set1_epi32(2)), _mm_set1_epi32(palette[2])));
+    r = _mm_or_si128(r, _mm_and_si128(_mm_cmpeq_epi32(idx, _mm_set1_epi32(3)), _mm_set1_epi32(palette[3])));
+    return r;
+}
+
+__attribute__((target("sse2")))
+static void map_row_sse2(const uint8_t *indices, const uint32_t *palette, uint32_t *pixels) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i idx8 = _mm_and_si128(_mm_loadl_epi64((const __m128i *)indices), _mm_set1_epi8(3));
+    __m128i idx16 = _mm_unpacklo_epi8(idx8, zero);
+
+    _mm_storeu_si128((__m128i *)pixels, map_half_sse2(_mm_unpacklo_epi16(idx16, zero), palette));
+    _mm_storeu_si128((__m128i *)(pixels + 4), map_half_sse2(_mm_unpackhi_epi16(idx16, zero), palette));
+}
+
+// the palette sits in the low four lanes, one permute maps all eight pixels
+__attribute__((target("avx2")))
+static void map_row_avx2(const uint8_t *indices, const uint32_t *palette, uint32_t *pixels) {
+    __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)indices));
+    __m256i pal = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)palette));
+
+    idx = _mm256_and_si256(idx, _mm256_set1_epi32(3));
+    _mm256_storeu_si256((__m256i *)pixels, _mm256_permutevar8x32_epi32(pal, idx));
+}
+
+#endif
+
+static const ppu_kernels kernel_sets[] = {
+    {"scalar", false, ppu_decode_row_scalar, ppu_map_row_scalar},
+#ifdef PPU_KERNELS_X86
+    {"sse2", true, decode_row_sse2, map_row_sse2},
+    // the decode only fills 8 bytes, 256 bit lanes don't help it
+    {"avx2", true, decode_row_sse2, map_row_avx2},
+#endif
+};
+
+static int supported = 1;
+static pthread_once_t supported_once = PTHREAD_ONCE_INIT;
+
+// instances may be created on several threads at once
+static void detect_kernel_sets() {
+#ifdef PPU_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        supported = 2;
+        if (__builtin_cpu_supports("avx2")) {
+            supported = 3;
+        }
+    }
+#endif
+}
+
+const ppu_kernels *ppu_kernels_available(int *count) {
+    pthread_once(&supported_once, detect_kernel_sets);
+
+    *count = supported;
+    return kernel_sets;
+}
+
+const ppu_kernels *ppu_kernels_get() {
+    int count;
+    const ppu_kernels *sets = ppu_kernels_available(&count);
+
+    return &sets[count - 1];
+}
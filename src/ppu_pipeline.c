@@ -1,300 +1,459 @@
+#include <emulator.h>
 #include <ppu.h>
 #include <bus.h>
 #include <cpu.h>
 #include <setup.h>
 #include <lcd.h>
+#include <tile_cache.h>
+#include <ppu_kernels.h>
 #include <stdint.h>
 #include <string.h>
 
-bool window_visible() {
-    return LCDC_WIN_ENABLE && lcd_get_context()->win_x >= 0 && lcd_get_context()->win_x <= 166
-    && lcd_get_context()->win_y >= 0 && lcd_get_context()->win_y < YRES;
+bool window_visible(Gameboy *gb) {
+    return LCDC_WIN_ENABLE(gb) && gb->lcd.win_x >= 0 && gb->lcd.win_x <= 166
+    && gb->lcd.win_y >= 0 && gb->lcd.win_y < YRES;
 }
 
 
-void pixel_fifo_push(uint32_t value) {
-    fifo_entry *next = malloc(sizeof(fifo_entry));
-    next->next = NULL;
-    next->value = value;
+void pixel_fifo_push(Gameboy *gb, uint32_t value) {
+    fifo *f = &gb->ppu.pfc.pixel_fifo;
 
-    if (!ppu_get_context()->pfc.pixel_fifo.head) {
-        //first entry
-        ppu_get_context()->pfc.pixel_fifo.head = ppu_get_context()->pfc.pixel_fifo.tail = next;
-    } else {
-        ppu_get_context()->pfc.pixel_fifo.tail->next = next;
-        ppu_get_context()->pfc.pixel_fifo.tail = next;
-    }
-
-    ppu_get_context()->pfc.pixel_fifo.size++;
+    f->pixels[f->tail] = value;
+    f->tail = (f->tail + 1) & (PIXEL_FIFO_SIZE - 1);
+    f->size++;
 }
 
-uint32_t pixel_fifo_pop() {
-    if (ppu_get_context()->pfc.pixel_fifo.size <= 0) {
+uint32_t pixel_fifo_pop(Gameboy *gb) {
+    fifo *f = &gb->ppu.pfc.pixel_fifo;
+
+    if (f->size <= 0) {
         fprintf(stderr, "ERROR in pixel fifo\n");
         exit(-8);
     }
 
-    fifo_entry *popped = ppu_get_context()->pfc.pixel_fifo.head;
-    ppu_get_context()->pfc.pixel_fifo.head = popped->next;
-    ppu_get_context()->pfc.pixel_fifo.size--;
-
-    uint32_t value = popped->value;
-    free(popped);
+    uint32_t value = f->pixels[f->head];
+    f->head = (f->head + 1) & (PIXEL_FIFO_SIZE - 1);
+    f->size--;
 
     return value;
 }
 
-uint32_t fetch_sprite_pixels(int bit, uint32_t color, uint8_t bg_color) {
-    for (int i=0; i<ppu_get_context()->fetched_entry_count; i++) {
-	int sprite_x = (ppu_get_context()->fetched_entries[i].x - 8) + (lcd_get_context()->scroll_x % 8);
+uint32_t fetch_sprite_pixels(Gameboy *gb, uint32_t color, uint8_t bg_color) {
+    for (int i=0; i<gb->ppu.fetched_entry_count; i++) {
+	int sprite_x = (gb->ppu.fetched_entries[i].x - 8) + (gb->lcd.scroll_x % 8);
 
-	if (sprite_x + 8 < ppu_get_context()->pfc.fifo_x) {
+	if (sprite_x + 8 < gb->ppu.pfc.fifo_x) {
 	    //past
 	    continue;
 	}
 
-	int offset = ppu_get_context()->pfc.fifo_x - sprite_x;
+	int offset = gb->ppu.pfc.fifo_x - sprite_x;
 
 	if (offset < 0 || offset > 7) {
 	    continue;
 	}
 
-	bit = (7 - offset);
+	uint8_t index = gb->ppu.pfc.entry_rows[i][offset];
 
-	if (ppu_get_context()->fetched_entries[i].f_x_flip) {
-	    bit = offset;
-	}
+	bool bg_priority = gb->ppu.fetched_entries[i].f_bgp;
 
-	uint8_t hi = !!(ppu_get_context()->pfc.fetch_entry_data[i * 2] & (1 << bit));
-	uint8_t lo = !!(ppu_get_context()->pfc.fetch_entry_data[(i * 2) + 1] & (1 << bit)) << 1;
-
-	bool bg_priority = ppu_get_context()->fetched_entries[i].f_bgp;
-
-	if (!(hi|lo)) {
+	if (!index) {
 	    //bg transparent
 	    continue;
 	}
 
 	if (!bg_priority || bg_color == 0) {
-	    color = (ppu_get_context()->fetched_entries[i].f_pn) ? lcd_get_context()->sp2_colors[hi|lo] : lcd_get_context()->sp1_colors[hi|lo];
-
-	    if (hi|lo) {
-		break;
-	    }
+	    color = (gb->ppu.fetched_entries[i].f_pn) ? gb->lcd.sp2_colors[index] : gb->lcd.sp1_colors[index];
+	    break;
 	}
     }
     return color;
 }
 
-bool pipeline_fifo_add() {
-    if (ppu_get_context()->pfc.pixel_fifo.size > 8) {
+// the 0x8800 area takes signed tile indices around 0x9000
+static uint16_t bgw_tile_address(Gameboy *gb, uint8_t tile_index) {
+    if (LCDC_BGW_DATA_AREA(gb) == 0x8000) {
+        return 0x8000 + (tile_index * 16);
+    }
+    return 0x9000 + ((int8_t)tile_index * 16);
+}
+
+// takes the decoded row from the cache unless the first byte changed since it was fetched
+static void pipeline_decode_row(Gameboy *gb, uint16_t address, uint8_t lo, uint8_t hi, bool flip, uint8_t *pixels) {
+    if (ppu_vram_read(gb, address) == lo) {
+        memcpy(pixels, tile_cache_row(gb, address, flip), 8);
+        return;
+    }
+
+    uint8_t decoded[8];
+    ppu_decode_row(gb->kernels, lo, hi, decoded);
+    for (int i = 0; i < 8; i++) {
+        pixels[i] = flip ? decoded[7 - i] : decoded[i];
+    }
+}
+
+bool pipeline_fifo_add(Gameboy *gb) {
+    if (gb->ppu.pfc.pixel_fifo.size > 8) {
         //full
         return false;
     }
 
-    int x = ppu_get_context()->pfc.fetch_x - (8 - (lcd_get_context()->scroll_x % 8));
+    int x = gb->ppu.pfc.fetch_x - (8 - (gb->lcd.scroll_x % 8));
+    bool bgw_enable = LCDC_BGW_ENABLE(gb);
+    bool obj_enable = LCDC_OBJ_ENABLE(gb);
 
     for (int i=0; i<8; i++) {
-        int bit = 7 - i;
-        uint8_t lo = !!(ppu_get_context()->pfc.bgw_fetch_data[1] & (1 << bit));
-        uint8_t hi = !!(ppu_get_context()->pfc.bgw_fetch_data[2] & (1 << bit)) << 1;
-        uint32_t color = lcd_get_context()->bg_colors[hi | lo];
+        uint8_t index = gb->ppu.pfc.bgw_row[i];
+        uint32_t color = gb->lcd.bg_colors[index];
 	
-	if (!LCDC_BGW_ENABLE) {
-	    color = lcd_get_context()->bg_colors[0];
+	if (!bgw_enable) {
+	    color = gb->lcd.bg_colors[0];
 	}
 
-	if (LCDC_OBJ_ENABLE) {
-	    color = fetch_sprite_pixels(bit, color, hi | lo);
+	if (obj_enable) {
+	    color = fetch_sprite_pixels(gb, color, index);
 	}
 
         if (x >= 0) {
-            pixel_fifo_push(color);
-            ppu_get_context()->pfc.fifo_x++;
+            pixel_fifo_push(gb, color);
+            gb->ppu.pfc.fifo_x++;
         }
     }
 
     return true;
 }
 
-void pipeline_load_sprite_tile() {
-    oam_line_entry *le = ppu_get_context()->line_sprites;
+void pipeline_load_sprite_tile(Gameboy *gb) {
+    oam_line_entry *le = gb->ppu.line_sprites;
 
     while (le) {
-	int sprite_x = (le->entry.x - 8) + (lcd_get_context()->scroll_x % 8);
+	int sprite_x = (le->entry.x - 8) + (gb->lcd.scroll_x % 8);
 
-	if ((sprite_x >= ppu_get_context()->pfc.fetch_x && sprite_x < ppu_get_context()->pfc.fetch_x + 8) || ((sprite_x + 8) >= ppu_get_context()->pfc.fetch_x
-	&& (sprite_x + 8) < ppu_get_context()->pfc.fetch_x + 8)) {
+	if ((sprite_x >= gb->ppu.pfc.fetch_x && sprite_x < gb->ppu.pfc.fetch_x + 8) || ((sprite_x + 8) >= gb->ppu.pfc.fetch_x
+	&& (sprite_x + 8) < gb->ppu.pfc.fetch_x + 8)) {
 	    //add
-	    ppu_get_context()->fetched_entries[ppu_get_context()->fetched_entry_count++] = le->entry;
+	    gb->ppu.fetched_entries[gb->ppu.fetched_entry_count++] = le->entry;
 	}
 
 	le = le->next;
 
-	if (!le || ppu_get_context()->fetched_entry_count >= 3) {
+	if (!le || gb->ppu.fetched_entry_count >= 3) {
 	    //max 3
 	    break;
 	}
     }
 }
-void pipeline_load_sprite_data(uint8_t offset, Bus *bus) {
-    int current_y = lcd_get_context()->ly;
-    uint8_t sprite_height = LCDC_OBJ_HEIGHT;
+void pipeline_load_sprite_data(Gameboy *gb, uint8_t offset) {
+    int current_y = gb->lcd.ly;
+    uint8_t sprite_height = LCDC_OBJ_HEIGHT(gb);
 
-    for (int i=0; i<ppu_get_context()->fetched_entry_count; i++) {
-	uint8_t ty = ((current_y + 16) - ppu_get_context()->fetched_entries[i].y) * 2;
+    for (int i=0; i<gb->ppu.fetched_entry_count; i++) {
+	uint8_t ty = ((current_y + 16) - gb->ppu.fetched_entries[i].y) * 2;
 
-	if (ppu_get_context()->fetched_entries[i].f_y_flip) {
+	if (gb->ppu.fetched_entries[i].f_y_flip) {
 	    ty = ((sprite_height * 2) - 2) - ty;
 	}
 
-	uint8_t tile_index = ppu_get_context()->fetched_entries[i].tile;
+	uint8_t tile_index = gb->ppu.fetched_entries[i].tile;
 
 	if (sprite_height == 16) {
 	    tile_index &= ~(1);
 	}
 
-	ppu_get_context()->pfc.fetch_entry_data[(i * 2) + offset] = BusRead16(bus, (0x8000 + (tile_index * 16) + ty + offset));
+	uint16_t address = 0x8000 + (tile_index * 16) + ty;
+	gb->ppu.pfc.fetch_entry_data[(i * 2) + offset] = BusRead16(&gb->bus, address + offset);
+
+	if (offset) {
+	    pipeline_decode_row(gb, address, gb->ppu.pfc.fetch_entry_data[i * 2], gb->ppu.pfc.fetch_entry_data[(i * 2) + 1],
+		gb->ppu.fetched_entries[i].f_x_flip, gb->ppu.pfc.entry_rows[i]);
+	}
     }
 }
-void pipeline_load_window_tile(Bus *bus) {
-    if (!window_visible()) {
+void pipeline_load_window_tile(Gameboy *gb) {
+    if (!window_visible(gb)) {
 	return;
     }
 
-    uint8_t window_y = lcd_get_context()->win_y;
+    uint8_t window_y = gb->lcd.win_y;
 
-    if (ppu_get_context()->pfc.fetch_x + 7 >= lcd_get_context()->win_x && 
-	ppu_get_context()->pfc.fetch_x + 7 < lcd_get_context()->win_x + YRES + 14) {
-	if (lcd_get_context()->ly >= window_y && lcd_get_context()->ly < window_y + XRES) {
-	    uint8_t w_tile_y = ppu_get_context()->window_line / 8;
+    if (gb->ppu.pfc.fetch_x + 7 >= gb->lcd.win_x && 
+	gb->ppu.pfc.fetch_x + 7 < gb->lcd.win_x + YRES + 14) {
+	if (gb->lcd.ly >= window_y && gb->lcd.ly < window_y + XRES) {
+	    uint8_t w_tile_y = gb->ppu.window_line / 8;
 	    
-	    ppu_get_context()->pfc.bgw_fetch_data[0] = BusRead(bus, (
-		LCDC_WIN_MAP_AREA + 
-		((ppu_get_context()->pfc.fetch_x + 7 - lcd_get_context()->win_x) / 8) 
+	    gb->ppu.pfc.bgw_fetch_data[0] = BusRead(&gb->bus, (
+		LCDC_WIN_MAP_AREA(gb) + 
+		((gb->ppu.pfc.fetch_x + 7 - gb->lcd.win_x) / 8) 
 		+ (w_tile_y * 32)));
 
-		//    if (LCDC_BGW_DATA_AREA == 0x8800) {
-		// ppu_get_context()->pfc.bgw_fetch_data[0] += 128;
+		//    if (LCDC_BGW_DATA_AREA(gb) == 0x8800) {
+		// gb->ppu.pfc.bgw_fetch_data[0] += 128;
 		//    }
 	}
     }
 }
-void pipeline_fetch(Bus *bus) {
-    switch(ppu_get_context()->pfc.cur_fetch_state) {
+void pipeline_fetch(Gameboy *gb) {
+    switch(gb->ppu.pfc.cur_fetch_state) {
         case FS_TILE: {
-	    ppu_get_context()->fetched_entry_count = 0;
-            if (LCDC_BGW_ENABLE) {
-                ppu_get_context()->pfc.bgw_fetch_data[0] = BusRead(bus, (LCDC_BG_MAP_AREA + 
-                (ppu_get_context()->pfc.map_x / 8) + 
-                ((ppu_get_context()->pfc.map_y / 8) * 32)));
+	    gb->ppu.fetched_entry_count = 0;
+            if (LCDC_BGW_ENABLE(gb)) {
+                gb->ppu.pfc.bgw_fetch_data[0] = BusRead(&gb->bus, (LCDC_BG_MAP_AREA(gb) + 
+                (gb->ppu.pfc.map_x / 8) + 
+                ((gb->ppu.pfc.map_y / 8) * 32)));
                 
-                // if (LCDC_BGW_DATA_AREA == 0x8800) {
-                //     ppu_get_context()->pfc.bgw_fetch_data[0] += 128;
-                //     // int8_t signed_int = (int8_t)ppu_get_context()->pfc.bgw_fetch_data[0];
-                //     // ppu_get_context()->pfc.bgw_fetch_data[0] = (uint8_t)(signed_int + 128);
-                //     // ppu_get_context()->pfc.bgw_fetch_data[0] += 28;
+                // if (LCDC_BGW_DATA_AREA(gb) == 0x8800) {
+                //     gb->ppu.pfc.bgw_fetch_data[0] += 128;
+                //     // int8_t signed_int = (int8_t)gb->ppu.pfc.bgw_fetch_data[0];
+                //     // gb->ppu.pfc.bgw_fetch_data[0] = (uint8_t)(signed_int + 128);
+                //     // gb->ppu.pfc.bgw_fetch_data[0] += 28;
                 // }
 
-		pipeline_load_window_tile(bus);
+		pipeline_load_window_tile(gb);
 
             }
 
-	    if (LCDC_OBJ_ENABLE && ppu_get_context()->line_sprites) {
-		pipeline_load_sprite_tile();
+	    if (LCDC_OBJ_ENABLE(gb) && gb->ppu.line_sprites) {
+		pipeline_load_sprite_tile(gb);
 	    }
-            ppu_get_context()->pfc.cur_fetch_state = FS_DATA0;
-            ppu_get_context()->pfc.fetch_x += 8;
+            gb->ppu.pfc.cur_fetch_state = FS_DATA0;
+            gb->ppu.pfc.fetch_x += 8;
         } break;
         case FS_DATA0: {
-	    uint8_t tile_index = ppu_get_context()->pfc.bgw_fetch_data[0];
-	    uint16_t tile_data_base;
-
-	    if (BIT(lcd_get_context()->lcdc, 4)) {
-		tile_data_base = 0x8000 + (tile_index * 16);
-	    } else {
-		int8_t s_index = (int8_t)tile_index;
-		tile_data_base = 0x9000 + (s_index * 16);
-	    }
-	    
-	    uint16_t address = tile_data_base + ppu_get_context()->pfc.tile_y;
-	    ppu_get_context()->pfc.bgw_fetch_data[1] = ppu_vram_read(address);
+	    uint16_t address = bgw_tile_address(gb, gb->ppu.pfc.bgw_fetch_data[0]) + gb->ppu.pfc.tile_y;
+	    gb->ppu.pfc.bgw_fetch_data[1] = ppu_vram_read(gb, address);
 
-	    pipeline_load_sprite_data(0, bus);
-	    ppu_get_context()->pfc.cur_fetch_state = FS_DATA1;
+	    pipeline_load_sprite_data(gb, 0);
+	    gb->ppu.pfc.cur_fetch_state = FS_DATA1;
 	    //
-	    //        ppu_get_context()->pfc.bgw_fetch_data[1] = BusRead(bus, (LCDC_BGW_DATA_AREA + (ppu_get_context()->pfc.bgw_fetch_data[0] * 16) + ppu_get_context()->pfc.tile_y));
+	    //        gb->ppu.pfc.bgw_fetch_data[1] = BusRead(&gb->bus, (LCDC_BGW_DATA_AREA(gb) + (gb->ppu.pfc.bgw_fetch_data[0] * 16) + gb->ppu.pfc.tile_y));
 	    //
-	    // pipeline_load_sprite_data(0, bus);
+	    // pipeline_load_sprite_data(gb, 0);
 	    //
-	    //        ppu_get_context()->pfc.cur_fetch_state = FS_DATA1;
+	    //        gb->ppu.pfc.cur_fetch_state = FS_DATA1;
         } break;
         case FS_DATA1: {
-	    uint8_t tile_index = ppu_get_context()->pfc.bgw_fetch_data[0];
-	    uint16_t tile_data_base;
-
-	    if (BIT(lcd_get_context()->lcdc, 4)) {
-		tile_data_base = 0x8000 + (tile_index * 16);
-	    } else {
-		int8_t s_index = (int8_t)tile_index;
-		tile_data_base = 0x9000 + (s_index * 16);
-	    }
-
-	    uint16_t address = tile_data_base + ppu_get_context()->pfc.tile_y + 1;
-	    ppu_get_context()->pfc.bgw_fetch_data[2] = ppu_vram_read(address);
-
-	    pipeline_load_sprite_data(1, bus);
-	    ppu_get_context()->pfc.cur_fetch_state = FS_IDLE;
-	    //        ppu_get_context()->pfc.bgw_fetch_data[2] = BusRead(bus, (LCDC_BGW_DATA_AREA + (ppu_get_context()->pfc.bgw_fetch_data[0] * 16) + ppu_get_context()->pfc.tile_y + 1));
+	    uint16_t address = bgw_tile_address(gb, gb->ppu.pfc.bgw_fetch_data[0]) + gb->ppu.pfc.tile_y + 1;
+	    gb->ppu.pfc.bgw_fetch_data[2] = ppu_vram_read(gb, address);
+	    pipeline_decode_row(gb, address - 1, gb->ppu.pfc.bgw_fetch_data[1], gb->ppu.pfc.bgw_fetch_data[2],
+		false, gb->ppu.pfc.bgw_row);
+
+	    pipeline_load_sprite_data(gb, 1);
+	    gb->ppu.pfc.cur_fetch_state = FS_IDLE;
+	    //        gb->ppu.pfc.bgw_fetch_data[2] = BusRead(&gb->bus, (LCDC_BGW_DATA_AREA(gb) + (gb->ppu.pfc.bgw_fetch_data[0] * 16) + gb->ppu.pfc.tile_y + 1));
 	    //
-	    // pipeline_load_sprite_data(1, bus);
+	    // pipeline_load_sprite_data(gb, 1);
 	    //
-	    //        ppu_get_context()->pfc.cur_fetch_state = FS_IDLE;
+	    //        gb->ppu.pfc.cur_fetch_state = FS_IDLE;
         } break;
         case FS_IDLE: {
-            ppu_get_context()->pfc.cur_fetch_state = FS_PUSH;
+            gb->ppu.pfc.cur_fetch_state = FS_PUSH;
         } break;
         case FS_PUSH: {
-            if (pipeline_fifo_add()) {
-                ppu_get_context()->pfc.cur_fetch_state = FS_TILE;
+            if (pipeline_fifo_add(gb)) {
+                gb->ppu.pfc.cur_fetch_state = FS_TILE;
             }
         } break;
     }
 }
 
-void pipeline_push_pixel() {
-    if (ppu_get_context()->pfc.pixel_fifo.size > 8) {
-        uint32_t pixel_data = pixel_fifo_pop();
+void pipeline_push_pixel(Gameboy *gb) {
+    if (gb->ppu.pfc.pixel_fifo.size > 8) {
+        uint32_t pixel_data = pixel_fifo_pop(gb);
+
+        if (gb->ppu.pfc.line_x >= (gb->lcd.scroll_x % 8)) {
+            gb->ppu.video_buffer[gb->ppu.pfc.pushed_x + (gb->lcd.ly * XRES)] = pixel_data;
+
+            gb->ppu.pfc.pushed_x++;
+        }
+
+        gb->ppu.pfc.line_x++;
+    }
+}
+
+void pipeline_process(Gameboy *gb) {
+    gb->ppu.pfc.map_y = (gb->lcd.ly + gb->lcd.scroll_y) % 256;
+    gb->ppu.pfc.map_x = (gb->ppu.pfc.fetch_x + gb->lcd.scroll_x) % 256;
+
+
+    gb->ppu.pfc.tile_y = ((gb->lcd.ly + gb->lcd.scroll_y) % 8) * 2;
+
+    if (!(gb->ppu.line_ticks & 1)) {
+        pipeline_fetch(gb);
+    }
+
+    pipeline_push_pixel(gb);
 
-        if (ppu_get_context()->pfc.line_x >= (lcd_get_context()->scroll_x % 8)) {
-            ppu_get_context()->video_buffer[ppu_get_context()->pfc.pushed_x + (lcd_get_context()->ly * XRES)] = pixel_data;
+}
 
-            ppu_get_context()->pfc.pushed_x++;
+// replays pipeline_process on the counters only, sprites and pixels don't change the length
+static uint32_t pipeline_replay(Gameboy *gb, uint8_t *fetch_x_end) {
+    pixel_fifo_context *pfc = &gb->ppu.pfc;
+    fetch_state state = pfc->cur_fetch_state;
+    uint32_t size = pfc->pixel_fifo.size;
+    uint8_t line_x = pfc->line_x;
+    uint8_t pushed_x = pfc->pushed_x;
+    uint8_t fetch_x = pfc->fetch_x;
+    uint32_t line_ticks = gb->ppu.line_ticks;
+    uint8_t fine_x = gb->lcd.scroll_x % 8;
+    uint32_t ticks = 0;
+
+    do {
+        ticks++;
+        line_ticks++;
+
+        if (!(line_ticks & 1)) {
+            switch(state) {
+                case FS_TILE: state = FS_DATA0; fetch_x += 8; break;
+                case FS_DATA0: state = FS_DATA1; break;
+                case FS_DATA1: state = FS_IDLE; break;
+                case FS_IDLE: state = FS_PUSH; break;
+                case FS_PUSH:
+                    if (size <= 8) {
+                        if (fetch_x - (8 - fine_x) >= 0) {
+                            size += 8;
+                        }
+                        state = FS_TILE;
+                    }
+                    break;
+            }
         }
 
-        ppu_get_context()->pfc.line_x++;
+        if (size > 8) {
+            size--;
+            if (line_x >= fine_x) {
+                pushed_x++;
+            }
+            line_x++;
+        }
+    } while (pushed_x < XRES);
+
+    if (fetch_x_end) {
+        *fetch_x_end = fetch_x;
     }
+    return ticks;
+}
+
+uint32_t pipeline_ticks_left(Gameboy *gb) {
+    return pipeline_replay(gb, NULL);
 }
 
-void pipeline_process(Bus *bus) {
-    ppu_get_context()->pfc.map_y = (lcd_get_context()->ly + lcd_get_context()->scroll_y) % 256;
-    ppu_get_context()->pfc.map_x = (ppu_get_context()->pfc.fetch_x + lcd_get_context()->scroll_x) % 256;
+void pipeline_schedule_line(Gameboy *gb) {
+    uint8_t fetch_x_end;
 
+    gb->ppu.xfer_end = gb->ppu.line_ticks + pipeline_replay(gb, &fetch_x_end);
+    gb->ppu.xfer_tiles = fetch_x_end / 8;
+}
 
-    ppu_get_context()->pfc.tile_y = ((lcd_get_context()->ly + lcd_get_context()->scroll_y) % 8) * 2;
+void pipeline_render_line(Gameboy *gb) {
+    pixel_fifo_context *pfc = &gb->ppu.pfc;
+    uint8_t fine_x = gb->lcd.scroll_x % 8;
+    uint32_t *line = &gb->ppu.video_buffer[gb->lcd.ly * XRES];
+    const lcdc_state *lcdc = &gb->lcd.lcdc_dec;
+    uint32_t blank_palette[4];
 
-    if (!(ppu_get_context()->line_ticks & 1)) {
-        pipeline_fetch(bus);
+    // bg and window off show color 0 everywhere
+    for (int i = 0; i < 4; i++) {
+        blank_palette[i] = gb->lcd.bg_colors[0];
     }
 
-    pipeline_push_pixel();
+    pfc->map_y = (gb->lcd.ly + gb->lcd.scroll_y) % 256;
+    pfc->tile_y = ((gb->lcd.ly + gb->lcd.scroll_y) % 8) * 2;
+
+    // walks the same tiles as pipeline_fetch, pixel n of the stream lands on x = n - fine_x
+    for (int tile = 0; tile < gb->ppu.xfer_tiles; tile++) {
+        pfc->fetch_x = tile * 8;
+        pfc->map_x = (pfc->fetch_x + gb->lcd.scroll_x) % 256;
+
+        // FS_TILE, the tile index is kept while bg and window are off
+        gb->ppu.fetched_entry_count = 0;
+        if (lcdc->bgw_enable) {
+            pfc->bgw_fetch_data[0] = BusRead(&gb->bus, (lcdc->bg_map_area +
+            (pfc->map_x / 8) +
+            ((pfc->map_y / 8) * 32)));
+
+            pipeline_load_window_tile(gb);
+        }
+
+        // tiles started after the last visible pixel only leave their index behind
+        if (tile * 8 >= fine_x + XRES) {
+            continue;
+        }
+
+        if (lcdc->obj_enable && gb->ppu.line_sprites) {
+            pipeline_load_sprite_tile(gb);
+        }
 
+        // FS_DATA0 and FS_DATA1
+        // nothing writes VRAM during the line, the cached row is always current
+        const uint8_t *row = tile_cache_row(gb, bgw_tile_address(gb, pfc->bgw_fetch_data[0]) + pfc->tile_y, false);
+        pipeline_load_sprite_data(gb, 0);
+        pipeline_load_sprite_data(gb, 1);
+
+        // without sprites the whole row goes through the palette at once
+        if (!gb->ppu.fetched_entry_count) {
+            const uint32_t *palette = lcdc->bgw_enable ? gb->lcd.bg_colors : blank_palette;
+            int first = tile * 8 - fine_x;
+
+            if (first >= 0 && first + 8 <= XRES) {
+                ppu_map_row(gb->kernels, row, palette, &line[first]);
+            } else {
+                uint32_t pixels[8];
+                ppu_map_row(gb->kernels, row, palette, pixels);
+                for (int i = 0; i < 8; i++) {
+                    if (first + i >= 0 && first + i < XRES) {
+                        line[first + i] = pixels[i];
+                    }
+                }
+            }
+            continue;
+        }
+
+        // FS_PUSH, same colors as pipeline_fifo_add
+        for (int i = 0; i < 8; i++) {
+            int n = tile * 8 + i;
+            uint32_t color = gb->lcd.bg_colors[row[i]];
+
+            if (!lcdc->bgw_enable) {
+                color = gb->lcd.bg_colors[0];
+            }
+
+            pfc->fifo_x = n;
+            if (lcdc->obj_enable) {
+                color = fetch_sprite_pixels(gb, color, row[i]);
+            }
+
+            if (n >= fine_x && n < fine_x + XRES) {
+                line[n - fine_x] = color;
+            }
+        }
+    }
+
+    pfc->fetch_x = gb->ppu.xfer_tiles * 8;
+    pfc->pushed_x = XRES;
 }
 
-void pipeline_fifo_reset() {
-    while(ppu_get_context()->pfc.pixel_fifo.size) {
-        pixel_fifo_pop();
+void pipeline_skip_line(Gameboy *gb) {
+    pixel_fifo_context *pfc = &gb->ppu.pfc;
+
+    // the next line starts from the tile index the last fetch left behind
+    if (gb->ppu.xfer_tiles && LCDC_BGW_ENABLE(gb)) {
+        pfc->fetch_x = (gb->ppu.xfer_tiles - 1) * 8;
+        pfc->map_y = (gb->lcd.ly + gb->lcd.scroll_y) % 256;
+        pfc->map_x = (pfc->fetch_x + gb->lcd.scroll_x) % 256;
+
+        pfc->bgw_fetch_data[0] = BusRead(&gb->bus, (LCDC_BG_MAP_AREA(gb) +
+        (pfc->map_x / 8) +
+        ((pfc->map_y / 8) * 32)));
+
+        pipeline_load_window_tile(gb);
     }
 
-    ppu_get_context()->pfc.pixel_fifo.head = 0;
+    pfc->fetch_x = gb->ppu.xfer_tiles * 8;
+    pfc->pushed_x = XRES;
+}
+
+void pipeline_fifo_reset(Gameboy *gb) {
+    gb->ppu.pfc.pixel_fifo.size = 0;
+    gb->ppu.pfc.pixel_fifo.head = 0;
+    gb->ppu.pfc.pixel_fifo.tail = 0;
 }
@@ -1,3 +1,4 @@
+#include <emulator.h>
 #include <bus.h>
 #include <ppu.h>
 #include <lcd.h>
@@ -7,153 +8,188 @@
 #include <stdint.h>
 
 
-bool window_visible();
+bool window_visible(Gameboy *gb);
 
-void increment_ly(Bus *bus) {
-    if (window_visible() && lcd_get_context()->ly >= lcd_get_context()->win_y &&
-	lcd_get_context()->ly < lcd_get_context()->win_y + YRES
+void increment_ly(Gameboy *gb) {
+    if (window_visible(gb) && gb->lcd.ly >= gb->lcd.win_y &&
+	gb->lcd.ly < gb->lcd.win_y + YRES
     ) {
-	ppu_get_context()->window_line++;
+	gb->ppu.window_line++;
     }
 
 
-    lcd_get_context()->ly++;
+    gb->lcd.ly++;
 
-    if (lcd_get_context()->ly == lcd_get_context()->ly_compare) {
-        LCDS_LYC_SET(1);
+    if (gb->lcd.ly == gb->lcd.ly_compare) {
+        LCDS_LYC_SET(gb, 1);
 
-        if (LCDS_STAT_INT(SS_LYC)) {
-            request_interrupt(bus, 2);
+        if (LCDS_STAT_INT(gb, SS_LYC)) {
+            request_interrupt(gb, 2);
         }
     } else {
-        LCDS_LYC_SET(0);
+        LCDS_LYC_SET(gb, 0);
     }
 }
 
-void load_lines_sprites() {
-    int current_y = lcd_get_context()->ly;
+void load_lines_sprites(Gameboy *gb) {
+    int current_y = gb->lcd.ly;
 
-    uint8_t sprite_height = LCDC_OBJ_HEIGHT;
-    memset(ppu_get_context()->line_entry_array, 0, sizeof(ppu_get_context()->line_entry_array));
+    uint8_t sprite_height = LCDC_OBJ_HEIGHT(gb);
+    memset(gb->ppu.line_entry_array, 0, sizeof(gb->ppu.line_entry_array));
 
-    for (int i=0; i<40; i++) {
-	oam_entry o = ppu_get_context()->oam_ram[i];
+    if (gb->ppu.sprite_lines_height != sprite_height) {
+	ppu_sprite_lines_rebuild(gb);
+    }
+
+    // only the sprites covering this line, lowest OAM index first
+    uint64_t candidates = gb->ppu.sprite_lines[current_y];
+
+    while (candidates) {
+	int i = __builtin_ctzll(candidates);
+	candidates &= candidates - 1;
+
+	oam_entry o = gb->ppu.oam_ram[i];
 
 	if (!o.x) {
 	    //x = 0 not visible
 	    continue;
 	}
 
-	if (ppu_get_context()->line_sprite_count >= 10) {
+	if (gb->ppu.line_sprite_count >= 10) {
 	    break;
 	}
 
-	if (o.y <= current_y + 16 && o.y + sprite_height > current_y + 16) {
-	    //sprite on current line_
-
-	    oam_line_entry *entry = &ppu_get_context()->line_entry_array[
-		ppu_get_context()->line_sprite_count++
-	    ];
-
-	    entry->entry = o;
-	    entry->next = NULL;
+	oam_line_entry *entry = &gb->ppu.line_entry_array[
+	    gb->ppu.line_sprite_count++
+	];
 
-	    if (!ppu_get_context()->line_sprites || ppu_get_context()->line_sprites->entry.x > o.x ) {
-		entry->next = ppu_get_context()->line_sprites;
-		ppu_get_context()->line_sprites = entry;
-		continue;
-	    }
+	entry->entry = o;
+	entry->next = NULL;
 
-	    //sort
+	if (!gb->ppu.line_sprites || gb->ppu.line_sprites->entry.x > o.x ) {
+	    entry->next = gb->ppu.line_sprites;
+	    gb->ppu.line_sprites = entry;
+	    continue;
+	}
 
-	    oam_line_entry *le = ppu_get_context()->line_sprites;
-	    oam_line_entry *prev = le;
+	//sort
 
-	    while(le) {
-		if (le->entry.x > o.x) {
-		    prev->next = entry;
-		    entry->next = le;
-		    break;
-		}
+	oam_line_entry *le = gb->ppu.line_sprites;
+	oam_line_entry *prev = le;
 
-		if (!le->next) {
-		    le->next = entry;
-		    break;
-		}
+	while(le) {
+	    if (le->entry.x > o.x) {
+		prev->next = entry;
+		entry->next = le;
+		break;
+	    }
 
-		prev = le;
-		le = le->next;
+	    if (!le->next) {
+		le->next = entry;
+		break;
 	    }
+
+	    prev = le;
+	    le = le->next;
 	}
     }
 }
 
-void ppu_mode_oam() {
-    // printf("OAM ticks=%d\n", ppu_get_context()->line_ticks);
+void ppu_mode_oam(Gameboy *gb) {
+    // printf("OAM ticks=%d\n", gb->ppu.line_ticks);
+
+    if (gb->ppu.line_ticks >= 80) {
+        LCDS_MODE_SET(gb, MODE_XFER);
 
-    if (ppu_get_context()->line_ticks >= 80) {
-        LCDS_MODE_SET(MODE_XFER);
+        gb->ppu.pfc.cur_fetch_state = FS_TILE;
+        gb->ppu.pfc.line_x = 0;
+        gb->ppu.pfc.fetch_x = 0;
+        gb->ppu.pfc.pushed_x = 0;
+        gb->ppu.pfc.fifo_x = 0;
 
-        ppu_get_context()->pfc.cur_fetch_state = FS_TILE;
-        ppu_get_context()->pfc.line_x = 0;
-        ppu_get_context()->pfc.fetch_x = 0;
-        ppu_get_context()->pfc.pushed_x = 0;
-        ppu_get_context()->pfc.fifo_x = 0;
+        if (!ppu_fifo_active(gb)) {
+            pipeline_schedule_line(gb);
+        }
     }
 
-    if (ppu_get_context()->line_ticks == 1) {
+    if (gb->ppu.line_ticks == 1) {
 	// read oam on the first tick
-	ppu_get_context()->line_sprites = 0;
-	ppu_get_context()->line_sprite_count = 0;
+	gb->ppu.line_sprites = 0;
+	gb->ppu.line_sprite_count = 0;
 
-	load_lines_sprites();
+	load_lines_sprites(gb);
     }
 }
-void ppu_mode_xfer(Bus *bus) {
-    pipeline_process(bus);
+void ppu_mode_xfer(Gameboy *gb) {
+    if (!ppu_fifo_active(gb)) {
+        // keeps the fifo timing, the line is drawn when it would have been finished
+        if (gb->ppu.line_ticks < gb->ppu.xfer_end) {
+            return;
+        }
 
-    if (ppu_get_context()->pfc.pushed_x >= XRES) {
-        pipeline_fifo_reset();
-        LCDS_MODE_SET(MODE_HBLANK);
+        if (gb->ppu.skip_frame) {
+            pipeline_skip_line(gb);
+        } else {
+            pipeline_render_line(gb);
+        }
+    } else {
+        pipeline_process(gb);
+    }
 
-        if (LCDS_STAT_INT(SS_HBLANK)) {
-            request_interrupt(bus, 2);
+    if (gb->ppu.pfc.pushed_x >= XRES) {
+        pipeline_fifo_reset(gb);
+        LCDS_MODE_SET(gb, MODE_HBLANK);
+
+        if (LCDS_STAT_INT(gb, SS_HBLANK)) {
+            request_interrupt(gb, 2);
         }
     }
 }
-void ppu_mode_vblank(Bus *bus) {
-    if (ppu_get_context()->line_ticks >= TICKS_PER_LINE) {
-        increment_ly(bus);
-        if (lcd_get_context()->ly >= 154) {
-            LCDS_MODE_SET(MODE_OAM);
-            lcd_get_context()->ly = 0;
-	    ppu_get_context()->window_line = 0;
+// decided once per frame, the setting can change at any time
+static void start_frame(Gameboy *gb) {
+    if (gb->ppu.frame_skip > 1 && gb->ppu.frames_skipped + 1 < gb->ppu.frame_skip) {
+        gb->ppu.skip_frame = true;
+        gb->ppu.frames_skipped++;
+    } else {
+        gb->ppu.skip_frame = false;
+        gb->ppu.frames_skipped = 0;
+    }
+}
+
+void ppu_mode_vblank(Gameboy *gb) {
+    if (gb->ppu.line_ticks >= TICKS_PER_LINE) {
+        increment_ly(gb);
+        if (gb->lcd.ly >= 154) {
+            LCDS_MODE_SET(gb, MODE_OAM);
+            gb->lcd.ly = 0;
+	    gb->ppu.window_line = 0;
+	    start_frame(gb);
         }
 
-        ppu_get_context()->line_ticks = 0;
+        gb->ppu.line_ticks = 0;
     }
 }
 
-void ppu_mode_hblank(Bus *bus) {
-    if (ppu_get_context()->line_ticks >= TICKS_PER_LINE) {
-        increment_ly(bus);
+void ppu_mode_hblank(Gameboy *gb) {
+    if (gb->ppu.line_ticks >= TICKS_PER_LINE) {
+        increment_ly(gb);
 
-        if (lcd_get_context()->ly >= YRES) {
-            LCDS_MODE_SET(MODE_VBLANK);
+        if (gb->lcd.ly >= YRES) {
+            LCDS_MODE_SET(gb, MODE_VBLANK);
 
-            request_interrupt(bus, 1); //vblank
+            request_interrupt(gb, 1); //vblank
 
-            if (LCDS_STAT_INT(SS_VBLANK)) {
-                request_interrupt(bus, 2);
+            if (LCDS_STAT_INT(gb, SS_VBLANK)) {
+                request_interrupt(gb, 2);
             }
-            ppu_get_context()->current_frame++;
+            gb->ppu.current_frame++;
 
             //todo RAYLIB
 
         } else {
-            LCDS_MODE_SET(MODE_OAM);
+            LCDS_MODE_SET(gb, MODE_OAM);
         }
 
-        ppu_get_context()->line_ticks = 0;
+        gb->ppu.line_ticks = 0;
     }
 }
@@ -1,25 +1,224 @@
 #include <setup.h>
 #include <rom.h>
+#include <emulator.h>
 #include <string.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#endif
+
+// images that are currently loaded, looked up by file so instances share one mapping
+static rom_image *images = NULL;
+#ifndef _WIN32
+static pthread_mutex_t images_lock = PTHREAD_MUTEX_INITIALIZER;
+#define IMAGES_LOCK() pthread_mutex_lock(&images_lock)
+#define IMAGES_UNLOCK() pthread_mutex_unlock(&images_lock)
+#else
+#define IMAGES_LOCK()
+#define IMAGES_UNLOCK()
+#endif
+
+void rom_header_parse(rom_header *header, const uint8_t *data, uint32_t size) {
+    static const uint32_t ram_sizes[] = {0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000};
+    uint8_t rom_code = data[0x148];
+    uint8_t ram_code = data[0x149];
+
+    memset(header, 0, sizeof(*header));
+    header->cgb_flag = data[0x143];
+    header->cart_type = data[0x147];
+
+    // the last title byte is the CGB flag on color games
+    int title_length = (header->cgb_flag & 0x80) ? 15 : 16;
+    for (int i = 0; i < title_length && data[0x134 + i]; i++) {
+        uint8_t c = data[0x134 + i];
+        header->title[i] = (c >= 0x20 && c < 0x7F) ? c : '?';
+    }
+
+    header->rom_size = (rom_code <= 0x08) ? (0x8000 << rom_code) : 0;
+    header->ram_size = (ram_code < sizeof(ram_sizes) / sizeof(ram_sizes[0])) ? ram_sizes[ram_code] : 0;
+
+    uint8_t checksum = 0;
+    for (int i = 0x134; i <= 0x14C; i++) {
+        checksum = checksum - data[i] - 1;
+    }
+    header->header_checksum = data[0x14D];
+    header->header_checksum_ok = checksum == data[0x14D];
+
+    // sum of every byte except the checksum itself
+    uint16_t global = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        global += data[i];
+    }
+    global -= data[0x14E] + data[0x14F];
+    header->global_checksum = (data[0x14E] << 8) | data[0x14F];
+    header->global_checksum_ok = global == header->global_checksum;
+}
+
+// copies files that can't be mapped as they are, missing banks read as 0xFF
+static uint8_t *rom_image_read(FILE *fpointer, uint32_t file_size, uint32_t size) {
+    uint8_t *data = malloc(size);
+    memset(data, 0xFF, size);
+
+    if (fread(data, 1, file_size, fpointer) != file_size) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+// takes a reference on an image of the same file, called with the lock held
+static rom_image *find_image(const struct stat *info) {
+    for (rom_image *image = images; image; image = image->next) {
+        if (image->device == (uint64_t)info->st_dev && image->inode == (uint64_t)info->st_ino &&
+            image->file_size == (uint32_t)info->st_size && image->mtime == (int64_t)info->st_mtime) {
+            image->refs++;
+            return image;
+        }
+    }
+    return NULL;
+}
+
+static void free_image(rom_image *image) {
+#ifndef _WIN32
+    if (image->mapped) {
+        munmap(image->data, image->size);
+        free(image);
+        return;
+    }
+#endif
+    free(image->data);
+    free(image);
+}
+
+rom_image *rom_image_open(const char *filename) {
+    struct stat info;
+
+    if (stat(filename, &info) != 0) {
+        fprintf(stderr, "Failed at stat: %s\n", filename);
+        return NULL;
+    }
+
+    // MBC5 tops out at 8 MB, anything without a full header can't be a ROM
+    if (info.st_size < 0x150 || info.st_size > 0x800000) {
+        fprintf(stderr, "Not a ROM, %lld bytes: %s\n", (long long)info.st_size, filename);
+        return NULL;
+    }
+
+    IMAGES_LOCK();
+    rom_image *shared = find_image(&info);
+    IMAGES_UNLOCK();
+    if (shared) {
+        return shared;
+    }
 
-bool LoadRom(Bus *bus, const char *filename) {
     FILE *fpointer = fopen(filename, "rb");
     if (!fpointer) {
-        printf("Failed at fopen");
-        return false;
+        fprintf(stderr, "Failed at fopen\n");
+        return NULL;
     }
 
-    // https://stackoverflow.com/questions/238603/how-can-i-get-a-files-size-in-c
-    fseek(fpointer, 0, SEEK_END);
-    long fsize = ftell(fpointer);
-    fseek(fpointer, 0, SEEK_SET);
-
+    rom_image *image = calloc(1, sizeof(rom_image));
+    image->file_size = info.st_size;
+    image->device = info.st_dev;
+    image->inode = info.st_ino;
+    image->mtime = info.st_mtime;
 
-    size_t bytesRead = fread(bus->memory, 1, fsize, fpointer); // dedicated to ROM
-    
-    printf("Loading %zu bytes from: %s \n", bytesRead, filename);
+    // the bank masks need a power of two
+    image->size = 0x8000;
+    while (image->size < image->file_size) {
+        image->size <<= 1;
+    }
 
+#ifndef _WIN32
+    // real dumps are always a power of two, the pages come straight from the page cache
+    if (image->size == image->file_size) {
+        void *data = mmap(NULL, image->size, PROT_READ, MAP_PRIVATE, fileno(fpointer), 0);
+        if (data != MAP_FAILED) {
+            image->data = data;
+            image->mapped = true;
+        }
+    }
+#endif
+    if (!image->data) {
+        image->data = rom_image_read(fpointer, image->file_size, image->size);
+    }
     fclose(fpointer);
+
+    if (!image->data) {
+        fprintf(stderr, "Failed to read: %s\n", filename);
+        free(image);
+        return NULL;
+    }
+
+    // the padding is not part of the dump, the global checksum only covers the file
+    rom_header_parse(&image->header, image->data, image->file_size);
+
+    // windows has no inode numbers to tell files apart, every load gets its own copy there
+    image->refs = 1;
+#ifndef _WIN32
+    // another thread may have loaded the same file while this one was reading it
+    IMAGES_LOCK();
+    shared = find_image(&info);
+    if (!shared) {
+        image->next = images;
+        images = image;
+    }
+    IMAGES_UNLOCK();
+
+    if (shared) {
+        free_image(image);
+        return shared;
+    }
+#endif
+
+    return image;
+}
+
+void rom_image_release(rom_image *image) {
+    if (!image) {
+        return;
+    }
+
+    IMAGES_LOCK();
+    if (--image->refs > 0) {
+        IMAGES_UNLOCK();
+        return;
+    }
+    for (rom_image **link = &images; *link; link = &(*link)->next) {
+        if (*link == image) {
+            *link = image->next;
+            break;
+        }
+    }
+    IMAGES_UNLOCK();
+
+    free_image(image);
+}
+
+bool LoadRom(Bus *bus, const char *filename) {
+    rom_image *image = rom_image_open(filename);
+    if (!image) {
+        return false;
+    }
+
+    rom_header *header = &image->header;
+    if (!header->header_checksum_ok) {
+        fprintf(stderr, "Header checksum mismatch, the boot ROM would refuse this cartridge: %s\n", filename);
+    }
+    if (header->rom_size && header->rom_size != image->size) {
+        fprintf(stderr, "Header says %u bytes of ROM, the file has %u: %s\n", header->rom_size, image->file_size, filename);
+    }
+
+    // the save file belongs to the cartridge being replaced
+    battery_close(gb_from_bus(bus));
+    mbc_load(&bus->mbc, image);
+    BusUpdateMap(bus);
+
+    fprintf(stderr, "Loading %u bytes from: %s (%s, \"%s\")\n", image->file_size, filename, mbc_name(&bus->mbc), header->title);
     return true;
 }
 
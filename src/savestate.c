@@ -0,0 +1,311 @@
+#include <setup.h>
+#include <emulator.h>
+#include <savestate.h>
+#include <rom.h>
+#include <idle.h>
+
+// sections are copied with the host struct layout, their sizes are checked on load
+// so a state from a build with a different layout is rejected instead of misread
+
+static const char savestate_magic[4] = {'G', 'B', 'S', 'S'};
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t section_count;
+    uint16_t rom_checksum;
+    uint16_t reserved;
+    uint32_t size;
+} savestate_header;
+
+typedef struct {
+    uint32_t id;
+    uint32_t size;
+} section_header;
+
+/**
+ * @brief Bank registers and the divider, the ROM itself is not stored
+ * */
+typedef struct {
+    uint16_t internal_divider;
+    mbc_registers mbc;
+    mbc_rtc rtc; // runs on emulated cycles, a state resumes with the clock it was saved with
+} bus_state;
+
+// order of the sprites in the line list, the list pointers are rebuilt from it
+#define LINE_ORDER_SIZE 10
+#define LINE_ORDER_END 0xFF
+
+static uint16_t rom_checksum(Gameboy *gb) {
+    if (!gb->bus.mbc.image) {
+        return 0;
+    }
+    return gb->bus.mbc.image->header.global_checksum;
+}
+
+static uint32_t section_size(Gameboy *gb, savestate_section section) {
+    switch (section) {
+        case SECTION_CPU: return sizeof(CPU);
+        case SECTION_BUS: return sizeof(bus_state);
+        case SECTION_IO: return sizeof(IORegisters);
+        case SECTION_WRAM: return sizeof(gb->bus.wram);
+        case SECTION_HRAM: return sizeof(gb->bus.hram);
+        case SECTION_CART_RAM: return gb->bus.mbc.ram_size;
+        case SECTION_PPU: return sizeof(ppu_context) + LINE_ORDER_SIZE;
+        case SECTION_LCD: return sizeof(lcd_context);
+        case SECTION_DMA: return sizeof(dma_context);
+        case SECTION_GAMEPAD: return sizeof(gamepad_context);
+        case SECTION_SCHED: return sizeof(sched_context);
+        default: return 0;
+    }
+}
+
+size_t savestate_size(Gameboy *gb) {
+    size_t size = sizeof(savestate_header);
+
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        size += sizeof(section_header) + section_size(gb, i);
+    }
+    return size;
+}
+
+static void save_ppu(Gameboy *gb, uint8_t *dst) {
+    ppu_context *ppu = &gb->ppu;
+    uint8_t *order = dst + sizeof(ppu_context);
+
+    memcpy(dst, ppu, sizeof(ppu_context));
+
+    // host pointers mean nothing in another process, clear them in the copy
+    memset(dst + offsetof(ppu_context, line_sprites), 0, sizeof(ppu->line_sprites));
+    memset(dst + offsetof(ppu_context, video_buffer), 0, sizeof(ppu->video_buffer));
+    for (int i = 0; i < LINE_ORDER_SIZE; i++) {
+        size_t offset = offsetof(ppu_context, line_entry_array) + i * sizeof(oam_line_entry) + offsetof(oam_line_entry, next);
+        memset(dst + offset, 0, sizeof(ppu->line_entry_array[i].next));
+    }
+
+    memset(order, LINE_ORDER_END, LINE_ORDER_SIZE);
+    int count = 0;
+    for (oam_line_entry *le = ppu->line_sprites; le && count < LINE_ORDER_SIZE; le = le->next) {
+        order[count++] = le - ppu->line_entry_array;
+    }
+}
+
+static bool line_order_valid(const uint8_t *order) {
+    for (int i = 0; i < LINE_ORDER_SIZE && order[i] != LINE_ORDER_END; i++) {
+        if (order[i] >= LINE_ORDER_SIZE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void load_ppu(Gameboy *gb, const uint8_t *src) {
+    ppu_context *ppu = &gb->ppu;
+    const uint8_t *order = src + sizeof(ppu_context);
+    uint32_t *video_buffer = ppu->video_buffer;
+    uint32_t frame_skip = ppu->frame_skip;
+
+    memcpy(ppu, src, sizeof(ppu_context));
+    ppu->video_buffer = video_buffer;
+    // a host setting, the frame in progress still finishes the way it was saved
+    ppu->frame_skip = frame_skip;
+    ppu->sprite_lines_height = 0;
+    tile_cache_reset(gb);
+
+    oam_line_entry **link = &ppu->line_sprites;
+    for (int i = 0; i < LINE_ORDER_SIZE; i++) {
+        ppu->line_entry_array[i].next = NULL;
+    }
+    for (int i = 0; i < LINE_ORDER_SIZE && order[i] != LINE_ORDER_END; i++) {
+        *link = &ppu->line_entry_array[order[i]];
+        link = &(*link)->next;
+    }
+    *link = NULL;
+}
+
+static void load_dma(Gameboy *gb, const uint8_t *src) {
+    bool bulk_enabled = gb->dma.bulk_enabled;
+
+    memcpy(&gb->dma, src, sizeof(dma_context));
+    // a host setting, a transfer in progress still finishes the way it was saved
+    gb->dma.bulk_enabled = bulk_enabled;
+}
+
+static void save_section(Gameboy *gb, savestate_section section, uint8_t *dst) {
+    bus_state bs;
+
+    switch (section) {
+        case SECTION_CPU: memcpy(dst, &gb->cpu, sizeof(CPU)); break;
+        case SECTION_BUS:
+            memset(&bs, 0, sizeof(bs));
+            bs.internal_divider = gb->bus.internal_divider;
+            bs.mbc = gb->bus.mbc.regs;
+            bs.rtc = gb->bus.mbc.rtc;
+            memcpy(dst, &bs, sizeof(bs));
+            break;
+        case SECTION_IO: memcpy(dst, &gb->bus.io, sizeof(IORegisters)); break;
+        case SECTION_WRAM: memcpy(dst, gb->bus.wram, sizeof(gb->bus.wram)); break;
+        case SECTION_HRAM: memcpy(dst, gb->bus.hram, sizeof(gb->bus.hram)); break;
+        case SECTION_CART_RAM:
+            if (gb->bus.mbc.ram_size) memcpy(dst, gb->bus.mbc.ram, gb->bus.mbc.ram_size);
+            break;
+        case SECTION_PPU: save_ppu(gb, dst); break;
+        case SECTION_LCD: memcpy(dst, &gb->lcd, sizeof(lcd_context)); break;
+        case SECTION_DMA: memcpy(dst, &gb->dma, sizeof(dma_context)); break;
+        case SECTION_GAMEPAD: memcpy(dst, &gb->gamepad, sizeof(gamepad_context)); break;
+        case SECTION_SCHED: memcpy(dst, &gb->sched, sizeof(sched_context)); break;
+        default: break;
+    }
+}
+
+static void load_section(Gameboy *gb, savestate_section section, const uint8_t *src) {
+    bus_state bs;
+
+    switch (section) {
+        case SECTION_CPU: memcpy(&gb->cpu, src, sizeof(CPU)); break;
+        case SECTION_BUS:
+            memcpy(&bs, src, sizeof(bs));
+            gb->bus.internal_divider = bs.internal_divider;
+            gb->bus.mbc.regs = bs.mbc;
+            gb->bus.mbc.rtc = bs.rtc;
+            break;
+        case SECTION_IO: memcpy(&gb->bus.io, src, sizeof(IORegisters)); break;
+        case SECTION_WRAM: memcpy(gb->bus.wram, src, sizeof(gb->bus.wram)); break;
+        case SECTION_HRAM: memcpy(gb->bus.hram, src, sizeof(gb->bus.hram)); break;
+        case SECTION_CART_RAM:
+            if (gb->bus.mbc.ram_size) memcpy(gb->bus.mbc.ram, src, gb->bus.mbc.ram_size);
+            // the battery file follows the loaded game
+            mbc_dirty_all(&gb->bus.mbc);
+            break;
+        case SECTION_PPU: load_ppu(gb, src); break;
+        case SECTION_LCD: memcpy(&gb->lcd, src, sizeof(lcd_context)); break;
+        case SECTION_DMA: load_dma(gb, src); break;
+        case SECTION_GAMEPAD: memcpy(&gb->gamepad, src, sizeof(gamepad_context)); break;
+        case SECTION_SCHED: memcpy(&gb->sched, src, sizeof(sched_context)); break;
+        default: break;
+    }
+}
+
+size_t savestate_save(Gameboy *gb, uint8_t *buffer, size_t size) {
+    size_t needed = savestate_size(gb);
+    if (size < needed) {
+        return 0;
+    }
+
+    savestate_header header = {
+        .version = SAVESTATE_VERSION,
+        .section_count = SECTION_COUNT,
+        .rom_checksum = rom_checksum(gb),
+        .size = needed
+    };
+    memcpy(header.magic, savestate_magic, sizeof(header.magic));
+    memcpy(buffer, &header, sizeof(header));
+
+    uint8_t *pos = buffer + sizeof(header);
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        section_header sh = {i, section_size(gb, i)};
+        memcpy(pos, &sh, sizeof(sh));
+        pos += sizeof(sh);
+
+        save_section(gb, i, pos);
+        pos += sh.size;
+    }
+
+    return needed;
+}
+
+bool savestate_load(Gameboy *gb, const uint8_t *buffer, size_t size) {
+    savestate_header header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, buffer, sizeof(header));
+
+    if (memcmp(header.magic, savestate_magic, sizeof(header.magic)) != 0 ||
+        header.version != SAVESTATE_VERSION ||
+        header.section_count != SECTION_COUNT ||
+        header.rom_checksum != rom_checksum(gb) ||
+        header.size != savestate_size(gb) ||
+        size < header.size) {
+        return false;
+    }
+
+    // validate everything before touching the running system
+    const uint8_t *pos = buffer + sizeof(header);
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        section_header sh;
+        memcpy(&sh, pos, sizeof(sh));
+        pos += sizeof(sh);
+
+        if (sh.id != (uint32_t)i || sh.size != section_size(gb, i)) {
+            return false;
+        }
+        if (i == SECTION_PPU && !line_order_valid(pos + sizeof(ppu_context))) {
+            return false;
+        }
+        pos += sh.size;
+    }
+
+    pos = buffer + sizeof(header);
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        pos += sizeof(section_header);
+        load_section(gb, i, pos);
+        pos += section_size(gb, i);
+    }
+
+    mbc_update(&gb->bus.mbc);
+    BusUpdateMap(&gb->bus);
+    // a loop seen before the load says nothing about the loaded state
+    idle_reset(gb);
+    return true;
+}
+
+bool savestate_save_file(Gameboy *gb, const char *filename) {
+    size_t size = savestate_size(gb);
+    uint8_t *buffer = malloc(size);
+    if (!buffer) {
+        return false;
+    }
+
+    savestate_save(gb, buffer, size);
+
+    FILE *fpointer = fopen(filename, "wb");
+    if (!fpointer) {
+        free(buffer);
+        return false;
+    }
+
+    bool ok = fwrite(buffer, 1, size, fpointer) == size;
+    fclose(fpointer);
+    free(buffer);
+    return ok;
+}
+
+bool savestate_load_file(Gameboy *gb, const char *filename) {
+    FILE *fpointer = fopen(filename, "rb");
+    if (!fpointer) {
+        return false;
+    }
+
+    fseek(fpointer, 0, SEEK_END);
+    long fsize = ftell(fpointer);
+    fseek(fpointer, 0, SEEK_SET);
+
+    // a state for this cartridge has exactly this size, anything larger is no state
+    if (fsize <= 0 || (size_t)fsize > savestate_size(gb)) {
+        fclose(fpointer);
+        return false;
+    }
+
+    uint8_t *buffer = malloc(fsize);
+    if (!buffer) {
+        fclose(fpointer);
+        return false;
+    }
+    size_t bytesRead = fread(buffer, 1, fsize, fpointer);
+    fclose(fpointer);
+
+    bool ok = savestate_load(gb, buffer, bytesRead);
+    free(buffer);
+    return ok;
+}
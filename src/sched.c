@@ -0,0 +1,101 @@
+#include <setup.h>
+#include <emulator.h>
+#include <bus.h>
+#include <dma.h>
+#include <ppu.h>
+#include <sched.h>
+#include <idle.h>
+
+void sched_init(Gameboy *gb) {
+    gb->sched.cycles = 0;
+    gb->sched.ticks = 0;
+    gb->sched.syncing = false;
+
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        gb->sched.deadline[i] = SCHED_NEVER;
+    }
+
+    // reschedule after the first instruction
+    gb->sched.next = 0;
+    idle_reset(gb);
+}
+
+void sched_advance(Gameboy *gb, int cycles) {
+    gb->sched.cycles += cycles;
+
+    if (gb->sched.cycles >= gb->sched.next) {
+        sched_sync(gb);
+        sched_reschedule(gb);
+    }
+}
+
+// timer and ppu don't touch each other's state, step them one after another
+static void sched_run(Gameboy *gb, uint64_t target) {
+    if (gb->sched.ticks < target) {
+        uint32_t ticks = target - gb->sched.ticks;
+
+        TimerStep(&gb->bus, ticks * 4);
+        ppu_run(gb, ticks);
+        gb->sched.ticks = target;
+    }
+}
+
+void sched_sync(Gameboy *gb) {
+    uint64_t target = gb->sched.cycles / 4;
+
+    if (gb->sched.syncing || gb->sched.ticks >= target) {
+        return;
+    }
+    gb->sched.syncing = true;
+
+    // a bulk dma lands in one go, the ppu has to see OAM change on the same tick as byte by byte
+    if (gb->dma.active && gb->dma.bulk && gb->dma.bulk_end < target) {
+        sched_run(gb, gb->dma.bulk_end);
+        dma_finish_bulk(gb);
+    }
+
+    // dma reads the bus, keep the original interleaving while it runs
+    while (gb->sched.ticks < target && dma_transfering(gb) && !gb->dma.bulk) {
+        dma_tick(gb);
+        TimerStep(&gb->bus, 4);
+        ppu_tick(gb);
+        gb->sched.ticks++;
+    }
+
+    sched_run(gb, target);
+    gb->sched.syncing = false;
+}
+
+static uint64_t event_deadline(Gameboy *gb, uint32_t ticks) {
+    if (!ticks) {
+        return SCHED_NEVER;
+    }
+    return gb->sched.ticks + ticks;
+}
+
+void sched_reschedule(Gameboy *gb) {
+    gb->sched.deadline[EVENT_DMA] = event_deadline(gb, dma_ticks_to_event(gb));
+    gb->sched.deadline[EVENT_TIMER] = event_deadline(gb, TimerTicksToOverflow(&gb->bus));
+    gb->sched.deadline[EVENT_PPU] = event_deadline(gb, ppu_ticks_to_event(gb));
+
+    uint64_t next = SCHED_NEVER;
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        if (gb->sched.deadline[i] < next) {
+            next = gb->sched.deadline[i];
+        }
+    }
+
+    gb->sched.next = (next == SCHED_NEVER) ? SCHED_NEVER : next * 4;
+}
+
+uint32_t sched_halt_cycles(Gameboy *gb) {
+    uint64_t cycles = gb->sched.cycles;
+    uint64_t next = gb->sched.next;
+
+    // nothing scheduled leaves only the joypad, which the host sets between steps
+    if (next == SCHED_NEVER || next <= cycles + 4) {
+        return 4;
+    }
+    // lands on the same cycle stepping 4 at a time would first reach the deadline
+    return (next - cycles + 3) & ~3ULL;
+}
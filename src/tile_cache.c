@@ -0,0 +1,46 @@
+#include <setup.h>
+#include <emulator.h>
+#include <tile_cache.h>
+#include <ppu_kernels.h>
+
+static void tile_cache_decode(Gameboy *gb, uint16_t tile) {
+    tile_cache *tc = &gb->tile_cache;
+    const uint8_t *data = &gb->ppu.vram[tile * 16];
+
+    for (int row = 0; row < 8; row++) {
+        uint8_t *pixels = tc->rows[tile][row];
+        uint8_t *flipped = tc->flipped_rows[tile][row];
+
+        ppu_decode_row(gb->kernels, data[row * 2], data[row * 2 + 1], pixels);
+        for (int i = 0; i < 8; i++) {
+            flipped[i] = pixels[7 - i];
+        }
+    }
+
+    tc->valid[tile] = true;
+}
+
+void tile_cache_invalidate(Gameboy *gb, uint16_t address) {
+    uint16_t offset = address - 0x8000;
+
+    // the tile maps are read raw
+    if (offset < TILE_COUNT * 16) {
+        gb->tile_cache.valid[offset / 16] = false;
+    }
+}
+
+void tile_cache_reset(Gameboy *gb) {
+    memset(gb->tile_cache.valid, 0, sizeof(gb->tile_cache.valid));
+}
+
+const uint8_t *tile_cache_row(Gameboy *gb, uint16_t address, bool flip) {
+    uint16_t offset = address - 0x8000;
+    uint16_t tile = offset / 16;
+    uint8_t row = (offset % 16) / 2;
+
+    if (!gb->tile_cache.valid[tile]) {
+        tile_cache_decode(gb, tile);
+    }
+
+    return flip ? gb->tile_cache.flipped_rows[tile][row] : gb->tile_cache.rows[tile][row];
+}